@@ -0,0 +1,452 @@
+/* SPDX-License-Identifier: 0BSD */
+/* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
+
+#define _XOPEN_SOURCE 600
+
+/* Standard C library headers */
+#include <stdio.h> /* fprintf, perror, printf, stderr */
+#include <stdlib.h> /* EXIT_*, atoi, getenv, malloc, qsort, setenv */
+#include <string.h> /* memcpy, memset, strcpy, strlen */
+
+/* Standard UNIX/Linux (POSIX/SUS base) headers */
+#include <fcntl.h> /* O_*, open */
+#include <signal.h> /* SIGTERM, kill */
+#include <sys/resource.h> /* RUSAGE_CHILDREN, getrusage, struct rusage */
+#include <sys/socket.h> /* AF_UNIX, CMSG_*, SCM_RIGHTS, connect, ... */
+#include <sys/types.h> /* pid_t */
+#include <sys/un.h> /* struct sockaddr_un */
+#include <sys/wait.h> /* waitpid */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+#include <unistd.h> /* STD*_FILENO, X_OK, access, dup2, exec*, fork, pipe */
+
+
+/* Each case is a NULL-terminated argv, executed without PATH search: */
+static char * umaskexec_argv[] = {"./umaskexec", "027", "/bin/true", 0};
+static char * static_argv[] = {"./umaskexec-static", "027", "/bin/true", 0};
+static char * musl_argv[] = {"./umaskexec-musl", "027", "/bin/true", 0};
+static char * sh_argv[] = {"/bin/sh", "-c", "umask 027; exec /bin/true", 0};
+static char * true_argv[] = {"/bin/true", 0};
+static char * path_argv[] = {"./umaskexec", "027", "true", 0};
+
+/* The spawn server, and its client, which is exec'd like umaskexec: */
+#define SERVER_SOCKET "bench_launch.sock"
+static char * serve_argv[] = {"./umaskexec", "--serve", SERVER_SOCKET,
+                              "-j", "2", 0};
+static char * via_argv[] = {"./umaskexec", "--via", SERVER_SOCKET,
+                            "027", "/bin/true", 0};
+
+/* Fifteen PATH entries before the real ones, which is common enough: */
+static char const long_path_prefix[] =
+    "/nonexistent/1:/nonexistent/2:/nonexistent/3:/nonexistent/4:"
+    "/nonexistent/5:/nonexistent/6:/nonexistent/7:/nonexistent/8:"
+    "/nonexistent/9:/nonexistent/10:/nonexistent/11:/nonexistent/12:"
+    "/nonexistent/13:/nonexistent/14:/nonexistent/15:";
+
+
+static
+int compare_doubles(void const * a, void const * b)
+{
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+
+
+static
+double microseconds(struct timespec * start, struct timespec * end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e6
+         + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+
+static
+int run_once(char * * argv, double * wall, long * minor_faults)
+{
+    struct timespec start, end;
+    struct rusage before, after;
+    int status;
+    pid_t pid;
+
+    getrusage(RUSAGE_CHILDREN, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid = fork();
+    if(pid == -1)
+    {
+        return 0;
+    }
+    if(!pid)
+    {
+        execv(*argv, argv);
+        _exit(127);
+    }
+    if(waitpid(pid, &status, 0) == -1
+    || !WIFEXITED(status) || WEXITSTATUS(status))
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_CHILDREN, &after);
+
+    *wall = microseconds(&start, &end);
+    *minor_faults = after.ru_minflt - before.ru_minflt;
+    return 1;
+}
+
+
+static
+int bench(char * name, char * * argv, int runs)
+{
+    double * walls = malloc(runs * sizeof(double));
+    double * faults = malloc(runs * sizeof(double));
+    int run;
+
+    if(!walls || !faults)
+    {
+        perror("bench_launch: malloc");
+        return 0;
+    }
+
+    for(run = 0; run < runs; run += 1)
+    {
+        long minor_faults;
+        if(!run_once(argv, walls + run, &minor_faults))
+        {
+            fprintf(stderr, "bench_launch: %s: failed to run\n", name);
+            return 0;
+        }
+        faults[run] = minor_faults;
+    }
+
+    qsort(walls, runs, sizeof(double), compare_doubles);
+    qsort(faults, runs, sizeof(double), compare_doubles);
+
+    printf("%-12s %10.1f %10.1f %10.0f %10.0f\n", name,
+        walls[runs / 2], walls[runs * 99 / 100],
+        faults[runs / 2], faults[runs * 99 / 100]);
+
+    free(walls);
+    free(faults);
+    return 1;
+}
+
+
+static
+int set_long_path(void)
+{
+    char * path = getenv("PATH");
+    char * long_path;
+
+    if(!path)
+    {
+        path = "/bin:/usr/bin";
+    }
+    long_path = malloc(sizeof(long_path_prefix) + strlen(path));
+    if(!long_path)
+    {
+        perror("bench_launch: malloc");
+        return 0;
+    }
+    memcpy(long_path, long_path_prefix, sizeof(long_path_prefix) - 1);
+    strcpy(long_path + sizeof(long_path_prefix) - 1, path);
+    if(setenv("PATH", long_path, 1))
+    {
+        perror("bench_launch: setenv");
+        return 0;
+    }
+    return 1;
+}
+
+
+/* One umaskexec --batch process kept open on pipes: each launch is */
+/* a record written to it and a status line read back.               */
+static
+int bench_server(char * name, char * record, int runs)
+{
+    size_t record_length = strlen(record);
+    double * walls = malloc(runs * sizeof(double));
+    int to_server[2], from_server[2];
+    int run, status;
+    pid_t pid;
+
+    if(!walls || pipe(to_server) || pipe(from_server))
+    {
+        perror("bench_launch: server");
+        return 0;
+    }
+    pid = fork();
+    if(pid == -1)
+    {
+        perror("bench_launch: fork");
+        return 0;
+    }
+    if(!pid)
+    {
+        dup2(to_server[0], STDIN_FILENO);
+        dup2(from_server[1], STDOUT_FILENO);
+        close(to_server[1]);
+        close(from_server[0]);
+        execl("./umaskexec", "./umaskexec", "--batch", "-", (char *)0);
+        _exit(127);
+    }
+    close(to_server[0]);
+    close(from_server[1]);
+
+    for(run = 0; run < runs; run += 1)
+    {
+        struct timespec start, end;
+        char character = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(write(to_server[1], record, record_length) != (ssize_t)record_length)
+        {
+            perror("bench_launch: server");
+            return 0;
+        }
+        while(character != '\n')
+        {
+            if(read(from_server[0], &character, 1) != 1)
+            {
+                fprintf(stderr, "bench_launch: server: failed to run\n");
+                return 0;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        walls[run] = microseconds(&start, &end);
+    }
+    close(to_server[1]);
+    close(from_server[0]);
+    waitpid(pid, &status, 0);
+
+    qsort(walls, runs, sizeof(double), compare_doubles);
+    printf("%-12s %10.1f %10.1f %10s %10s\n", name,
+        walls[runs / 2], walls[runs * 99 / 100], "n/a", "n/a");
+
+    free(walls);
+    return 1;
+}
+
+
+/* Connects to the spawn server, and launches once the way a client */
+/* linked into a job runner would, without exec'ing umaskexec --via. */
+/* Returns 1 once the status is back, 0 if not connected yet, and   */
+/* -1 on other errors.                                               */
+static
+int launch_via_socket(int directory_fd)
+{
+    static char request[] = "027\0" "1\0" "/bin/true";
+    union
+    {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * 4)];
+    }
+    control;
+    struct sockaddr_un address;
+    struct msghdr message;
+    struct iovec part;
+    struct cmsghdr * header;
+    int fds[4];
+    char reply[128];
+    int lines = 0;
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, SERVER_SOCKET);
+    if(connection == -1)
+    {
+        return -1;
+    }
+    if(connect(connection, (struct sockaddr *)&address, sizeof(address)))
+    {
+        close(connection);
+        return 0;
+    }
+
+    fds[0] = STDIN_FILENO;
+    fds[1] = STDOUT_FILENO;
+    fds[2] = STDERR_FILENO;
+    fds[3] = directory_fd;
+    part.iov_base = request;
+    part.iov_len = sizeof(request);
+    memset(&message, 0, sizeof(message));
+    memset(&control, 0, sizeof(control));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+    if(sendmsg(connection, &message, 0) != (ssize_t)sizeof(request))
+    {
+        close(connection);
+        return -1;
+    }
+    shutdown(connection, SHUT_WR);
+
+    /* "<pid>\n", then "<pid> exit 0\n": the pidfd is just closed. */
+    while(lines < 2)
+    {
+        ssize_t received = read(connection, reply, sizeof(reply));
+        ssize_t index;
+        if(received <= 0)
+        {
+            close(connection);
+            return -1;
+        }
+        for(index = 0; index < received; index += 1)
+        {
+            lines += reply[index] == '\n';
+        }
+    }
+    close(connection);
+    return 1;
+}
+
+
+static
+int bench_via_socket(char * name, int runs)
+{
+    double * walls = malloc(runs * sizeof(double));
+    int directory_fd = open(".", O_RDONLY);
+    int run;
+
+    if(!walls || directory_fd == -1)
+    {
+        perror("bench_launch: via socket");
+        return 0;
+    }
+    for(run = 0; run < runs; run += 1)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(launch_via_socket(directory_fd) != 1)
+        {
+            fprintf(stderr, "bench_launch: %s: failed to run\n", name);
+            return 0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        walls[run] = microseconds(&start, &end);
+    }
+    close(directory_fd);
+
+    qsort(walls, runs, sizeof(double), compare_doubles);
+    printf("%-12s %10.1f %10.1f %10s %10s\n", name,
+        walls[runs / 2], walls[runs * 99 / 100], "n/a", "n/a");
+
+    free(walls);
+    return 1;
+}
+
+
+/* Starts the spawn server, and waits until it takes launches: */
+static
+pid_t start_server(void)
+{
+    int directory_fd = open(".", O_RDONLY);
+    int tries;
+    pid_t pid;
+
+    unlink(SERVER_SOCKET);
+    pid = fork();
+    if(pid == -1)
+    {
+        perror("bench_launch: fork");
+        return -1;
+    }
+    if(!pid)
+    {
+        execv(*serve_argv, serve_argv);
+        _exit(127);
+    }
+    for(tries = 0; tries < 1000; tries += 1)
+    {
+        struct timespec pause;
+        int result = launch_via_socket(directory_fd);
+        if(result)
+        {
+            close(directory_fd);
+            return result == 1 ? pid : -1;
+        }
+        pause.tv_sec = 0;
+        pause.tv_nsec = 1000000;
+        nanosleep(&pause, 0);
+    }
+    fprintf(stderr, "bench_launch: server did not start\n");
+    return -1;
+}
+
+
+int main(int argc, char * * argv)
+{
+    int runs = 1000;
+
+    if(argc > 1)
+    {
+        runs = atoi(argv[1]);
+    }
+    if(runs < 1)
+    {
+        fprintf(stderr, "usage: bench_launch [<runs>]\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("launch overhead, %d runs each (wall time in microseconds)\n",
+        runs);
+    printf("%-12s %10s %10s %10s %10s\n", "case",
+        "wall p50", "wall p99", "minflt p50", "minflt p99");
+
+    if(!bench("umaskexec", umaskexec_argv, runs)
+    || !bench("sh", sh_argv, runs)
+    || !bench("true", true_argv, runs))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if(!bench_server("batch pipe", "027 /bin/true\n", runs))
+    {
+        return EXIT_FAILURE;
+    }
+
+    /* The spawn server: a client exec'd per launch, like umaskexec, */
+    /* or a client which is already running, like a job runner:      */
+    {
+        int status;
+        pid_t server = start_server();
+        if(server == -1
+        || !bench("via", via_argv, runs)
+        || !bench_via_socket("via socket", runs))
+        {
+            return EXIT_FAILURE;
+        }
+        kill(server, SIGTERM);
+        waitpid(server, &status, 0);
+    }
+
+    /* The static builds are only compared if they were built: */
+    if(!access(*static_argv, X_OK)
+    && !bench("static", static_argv, runs))
+    {
+        return EXIT_FAILURE;
+    }
+    if(!access(*musl_argv, X_OK)
+    && !bench("musl", musl_argv, runs))
+    {
+        return EXIT_FAILURE;
+    }
+
+    /* PATH search: exec'ing umaskexec tries every entry each time, */
+    /* --batch only searches once per command:                       */
+    if(!set_long_path()
+    || !bench("long PATH", path_argv, runs)
+    || !bench_server("batch PATH", "027 true\n", runs))
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+/* SPDX-License-Identifier: 0BSD */
+/* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+/* Standard C library headers */
+#include <stdio.h> /* fprintf, perror, printf, stderr */
+#include <stdlib.h> /* EXIT_FAILURE, EXIT_SUCCESS, atol, malloc */
+#include <string.h> /* memcpy, memset, strlen */
+
+/* Standard UNIX/Linux (POSIX/SUS base) headers */
+#include <sys/stat.h> /* umask */
+#include <sys/types.h> /* mode_t */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+
+#ifdef __linux__
+#include <linux/perf_event.h> /* PERF_*, struct perf_event_attr */
+#include <sys/ioctl.h> /* ioctl */
+#include <sys/syscall.h> /* SYS_perf_event_open */
+#include <unistd.h> /* read, syscall */
+#endif
+
+
+#include "libumaskexec.h"
+
+
+/* Counts how many umask syscalls each parse costs: */
+
+static unsigned long umask_calls;
+
+static
+mode_t counted_umask(mode_t new_mask)
+{
+    umask_calls += 1;
+    return umask(new_mask);
+}
+
+
+/* What umaskexec does with a mask argument: octal masks do not depend */
+/* on the old mask, so only symbolic ones read it first.               */
+static
+int parse_and_use_mask(char * mask_string)
+{
+    mode_t mask;
+
+    if(!umaskexec_parse_mask_octal(mask_string, &mask))
+    {
+        counted_umask(mask);
+        return 1;
+    }
+    mask = counted_umask(0);
+    if(!umaskexec_parse_mask_symbolic(mask_string, &mask))
+    {
+        counted_umask(mask);
+        return 1;
+    }
+    return 0;
+}
+
+
+#ifdef __linux__
+static
+int open_branch_miss_counter(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#else
+static
+int open_branch_miss_counter(void)
+{
+    return -1;
+}
+#endif
+
+
+static
+double nanoseconds(struct timespec * start, struct timespec * end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9
+         + (end->tv_nsec - start->tv_nsec);
+}
+
+
+static
+void bench(char * name, char * mask_string, long iterations, int counter)
+{
+    struct timespec start, end;
+    double parse_time, real_time;
+    double branch_misses = -1;
+    long iteration;
+
+#ifdef __linux__
+    if(counter != -1)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(iteration = 0; iteration < iterations; iteration += 1)
+    {
+        mode_t mask = 022;
+        umaskexec_parse_mask(mask_string, &mask);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+#ifdef __linux__
+    if(counter != -1)
+    {
+        __u64 count;
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(counter, &count, sizeof(count)) == sizeof(count))
+        {
+            branch_misses = (double)count / iterations;
+        }
+    }
+#endif
+    parse_time = nanoseconds(&start, &end) / iterations;
+
+    umask_calls = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(iteration = 0; iteration < iterations; iteration += 1)
+    {
+        umask(022);
+        parse_and_use_mask(mask_string);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    /* The extra reset umask call is part of the loop, not the parse: */
+    real_time = nanoseconds(&start, &end) / iterations;
+
+    printf("%-16s %12.1f %12.1f %8.1f ", name, parse_time, real_time,
+        (double)umask_calls / iterations);
+    if(branch_misses < 0)
+    {
+        printf("%12s\n", "n/a");
+    }
+    else
+    {
+        printf("%12.2f\n", branch_misses);
+    }
+}
+
+
+static
+char * repeat(char * prefix, char * part, int count, char * suffix)
+{
+    size_t prefix_length = strlen(prefix);
+    size_t part_length = strlen(part);
+    size_t suffix_length = strlen(suffix);
+    char * string = malloc(
+        prefix_length + part_length * count + suffix_length + 1);
+    char * next = string;
+
+    if(!string)
+    {
+        perror("bench_parse: malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(next, prefix, prefix_length);
+    next += prefix_length;
+    while(count--)
+    {
+        memcpy(next, part, part_length);
+        next += part_length;
+    }
+    memcpy(next, suffix, suffix_length + 1);
+    return string;
+}
+
+
+int main(int argc, char * * argv)
+{
+    long iterations = 1000000;
+    int counter;
+
+    if(argc > 1)
+    {
+        iterations = atol(argv[1]);
+    }
+    if(iterations < 1)
+    {
+        fprintf(stderr, "usage: bench_parse [<iterations>]\n");
+        return EXIT_FAILURE;
+    }
+
+    counter = open_branch_miss_counter();
+
+    printf("mask parsing, %ld iterations each (times in nanoseconds)\n",
+        iterations);
+    printf("%-16s %12s %12s %8s %12s\n", "case",
+        "parse only", "with umask", "umask()", "branch-miss");
+
+    bench("octal", "022", iterations, counter);
+    bench("octal padded", "0000027", iterations, counter);
+    bench("symbolic =", "u=rwx,g=rx,o=", iterations, counter);
+    bench("symbolic -", "g-w", iterations, counter);
+    bench("symbolic mixed", "u+r,g-w,o-rwx,a+x", iterations, counter);
+    bench("bad octal", "0778", iterations, counter);
+    bench("bad symbolic", "u=rwx,g=rx,o=z", iterations, counter);
+
+    iterations /= 100;
+    if(!iterations)
+    {
+        iterations = 1;
+    }
+    bench("octal 1000", repeat("", "0", 997, "022"), iterations, counter);
+    bench("symbolic chain", repeat("", "u+r,g-w,", 250, "o="),
+        iterations, counter);
+    bench("bad chain", repeat("", "u+r,g-w,", 250, "o=z"),
+        iterations, counter);
+
+    return EXIT_SUCCESS;
+}
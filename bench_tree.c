@@ -0,0 +1,264 @@
+/* SPDX-License-Identifier: 0BSD */
+/* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
+
+#define _XOPEN_SOURCE 600
+
+/* Standard C library headers */
+#include <stdio.h> /* fprintf, perror, printf, snprintf, sprintf, stderr */
+#include <stdlib.h> /* EXIT_*, atof, qsort */
+#include <string.h> /* strstr */
+
+/* Standard UNIX/Linux (POSIX/SUS base) headers */
+#include <fcntl.h> /* O_*, open */
+#include <ftw.h> /* FTW_*, nftw, struct FTW */
+#include <sys/stat.h> /* chmod, mkdir, struct stat */
+#include <sys/types.h> /* pid_t */
+#include <sys/wait.h> /* waitpid */
+#include <unistd.h> /* STD*_FILENO, close, dup2, execv, fork, pipe, read */
+
+
+/* The synthetic tree: DIRECTORIES top-level directories, each with */
+/* SUBDIRECTORIES subdirectories of FILES files, about 100k inodes:  */
+#define DIRECTORIES 100
+#define SUBDIRECTORIES 10
+#define FILES 100
+#define RUNS 5
+
+static char const tree_name[] = "umaskexec-bench-tree";
+
+
+static
+int compare_doubles(void const * a, void const * b)
+{
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+
+
+/* Creates the tree, or with only_chmod, puts its files back to 0666: */
+static
+int build_tree(char * root, int only_chmod)
+{
+    char path[4096];
+    int directory, subdirectory, file;
+
+    if(!only_chmod && mkdir(root, 0755))
+    {
+        perror(root);
+        return 0;
+    }
+    for(directory = 0; directory < DIRECTORIES; directory += 1)
+    {
+        sprintf(path, "%s/d%d", root, directory);
+        if(!only_chmod && mkdir(path, 0755))
+        {
+            perror(path);
+            return 0;
+        }
+        for(subdirectory = 0; subdirectory < SUBDIRECTORIES;
+            subdirectory += 1)
+        {
+            sprintf(path, "%s/d%d/s%d", root, directory, subdirectory);
+            if(!only_chmod && mkdir(path, 0755))
+            {
+                perror(path);
+                return 0;
+            }
+            for(file = 0; file < FILES; file += 1)
+            {
+                sprintf(path, "%s/d%d/s%d/f%d", root, directory,
+                        subdirectory, file);
+                if(!only_chmod)
+                {
+                    int fd = open(path, O_CREAT | O_WRONLY, 0666);
+                    if(fd == -1)
+                    {
+                        perror(path);
+                        return 0;
+                    }
+                    close(fd);
+                }
+                /* Regardless of the umask this runs with: */
+                if(chmod(path, 0666))
+                {
+                    perror(path);
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+
+static
+int remove_entry(char const * path, struct stat const * status, int type,
+                 struct FTW * position)
+{
+    (void)status;
+    (void)position;
+    if(type == FTW_DP ? rmdir(path) : unlink(path))
+    {
+        perror(path);
+    }
+    return 0;
+}
+
+
+/* Runs umaskexec --apply-tree, returning the inodes per second from */
+/* its summary line, or a negative number if it failed:             */
+static
+double apply_tree(char * root, int dry_run, int use_uring, int * used_uring)
+{
+    char * argv[8];
+    char summary[512];
+    size_t used = 0;
+    ssize_t got;
+    char * rate;
+    int output[2];
+    int argc = 0;
+    int status;
+    pid_t pid;
+
+    argv[argc++] = "./umaskexec";
+    argv[argc++] = "--apply-tree";
+    argv[argc++] = root;
+    if(dry_run)
+    {
+        argv[argc++] = "--dry-run";
+    }
+    if(use_uring)
+    {
+        argv[argc++] = "--io-uring";
+    }
+    argv[argc++] = "022";
+    argv[argc] = 0;
+
+    if(pipe(output))
+    {
+        perror("bench_tree: pipe");
+        return -1;
+    }
+    pid = fork();
+    if(pid == -1)
+    {
+        perror("bench_tree: fork");
+        return -1;
+    }
+    if(!pid)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(output[1], STDERR_FILENO);
+        close(output[0]);
+        execv(*argv, argv);
+        _exit(127);
+    }
+    close(output[1]);
+    while((got = read(output[0], summary + used,
+                      sizeof(summary) - 1 - used)) > 0)
+    {
+        used += got;
+    }
+    close(output[0]);
+    summary[used] = '\0';
+
+    if(waitpid(pid, &status, 0) == -1
+    || !WIFEXITED(status) || WEXITSTATUS(status)
+    || !(rate = strstr(summary, "inodes_per_second=")))
+    {
+        fprintf(stderr, "bench_tree: umaskexec failed: %s", summary);
+        return -1;
+    }
+    *used_uring = !!strstr(summary, "engine=io_uring");
+    return atof(rate + sizeof("inodes_per_second=") - 1);
+}
+
+
+static
+int bench_tree(char * directory, char * root)
+{
+    double rates[RUNS];
+    int use_uring;
+
+    if(!build_tree(root, 0))
+    {
+        return 0;
+    }
+
+    for(use_uring = 0; use_uring < 2; use_uring += 1)
+    {
+        char * engine = use_uring ? "io_uring" : "stat";
+        int used_uring = 0;
+        double rate;
+        int run;
+
+        for(run = 0; run < RUNS; run += 1)
+        {
+            rates[run] = apply_tree(root, 1, use_uring, &used_uring);
+            if(rates[run] < 0)
+            {
+                return 0;
+            }
+        }
+        qsort(rates, RUNS, sizeof(double), compare_doubles);
+        if(use_uring && !used_uring)
+        {
+            engine = "io_uring (unavailable, fell back to stat)";
+        }
+        printf("%-24s %-10s %12.0f  %s\n", directory, "stat only",
+            rates[RUNS / 2], engine);
+
+        /* Every file has bits to take away, so every file is chmod'd: */
+        rate = apply_tree(root, 0, use_uring, &used_uring);
+        if(rate < 0 || !build_tree(root, 1))
+        {
+            return 0;
+        }
+        printf("%-24s %-10s %12.0f  %s\n", directory, "chmod all", rate,
+            engine);
+    }
+    return 1;
+}
+
+
+static
+int bench(char * directory)
+{
+    char root[4096];
+    int result;
+
+    if(snprintf(root, sizeof(root), "%s/%s", directory, tree_name)
+       >= (int)sizeof(root))
+    {
+        fprintf(stderr, "bench_tree: %s: too long\n", directory);
+        return 0;
+    }
+    result = bench_tree(directory, root);
+
+    /* Even a partly built tree is removed: */
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return result;
+}
+
+
+int main(int argc, char * * argv)
+{
+    char * default_directories[] = {"/dev/shm", 0};
+    char * * directories = argc > 1 ? argv + 1 : default_directories;
+
+    printf("--apply-tree on %d inodes (median inodes per second of %d runs"
+        " for stat only)\n",
+        1 + DIRECTORIES * (1 + SUBDIRECTORIES * (1 + FILES)), RUNS);
+    printf("%-24s %-10s %12s  %s\n", "directory", "case", "inodes/s",
+        "engine");
+    for(; *directories; directories += 1)
+    {
+        if(!bench(*directories))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: 0BSD */
+/* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
+
+/* Checks that umaskexec.hpp parses exactly like libumaskexec: every  */
+/* string of up to MAX_LENGTH characters from the mask alphabet, plus */
+/* characters which are never in a mask, against several old masks,  */
+/* must give the same new mask, or fail at the same offset.           */
+
+/* Standard C++ library headers */
+#include <cstdio> /* std::printf */
+#include <cstdlib> /* EXIT_FAILURE, EXIT_SUCCESS */
+
+/* Standard UNIX/Linux (POSIX/SUS base) headers */
+#include <sys/types.h> /* mode_t */
+
+#include "umaskexec.hpp"
+
+extern "C"
+{
+#include "libumaskexec.h"
+}
+
+
+/* Bad masks must fail the build, so good ones must at least compile: */
+static_assert(umaskexec::parse_or_throw("022").apply(0777) == 022, "octal");
+static_assert(umaskexec::parse_or_throw("g-w,o=").apply(0) == 027,
+              "symbolic");
+static_assert(umaskexec::parse("0778").error, "bad octal");
+static_assert(umaskexec::parse("u=z").error_offset == 2, "bad symbolic");
+
+
+#define MAX_LENGTH 5
+
+static char const alphabet[] = "01234567ugoa+-=rwx,8z";
+static mode_t const old_masks[] = {0, 022, 0777};
+
+static unsigned long cases;
+static unsigned long mismatches;
+
+
+static
+void compare(char const * mask_string, mode_t old_mask)
+{
+    umaskexec::parse_result const result = umaskexec::parse(mask_string);
+    mode_t mask = old_mask;
+    char const * error = umaskexec_parse_mask(mask_string, &mask);
+
+    cases += 1;
+    if(error ? !result.error
+             || result.error_offset != (std::size_t)(error - mask_string)
+             : result.error || result.mask.apply(old_mask) != mask)
+    {
+        mismatches += 1;
+        std::printf("mismatch: \"%s\" with old mask %03o\n", mask_string,
+                    (unsigned int)old_mask);
+    }
+}
+
+
+/* Compares mask_string as it is, then with each character appended: */
+static
+void compare_all(char * mask_string, std::size_t length)
+{
+    std::size_t index;
+
+    for(index = 0; index < sizeof(old_masks) / sizeof(*old_masks); index += 1)
+    {
+        compare(mask_string, old_masks[index]);
+    }
+    if(length == MAX_LENGTH)
+    {
+        return;
+    }
+    for(index = 0; alphabet[index]; index += 1)
+    {
+        mask_string[length] = alphabet[index];
+        mask_string[length + 1] = '\0';
+        compare_all(mask_string, length + 1);
+    }
+    mask_string[length] = '\0';
+}
+
+
+int main()
+{
+    char mask_string[MAX_LENGTH + 1] = "";
+
+    compare_all(mask_string, 0);
+    std::printf("umaskexec.hpp against libumaskexec: %lu cases, "
+                "%lu mismatches\n", cases, mismatches);
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: 0BSD */
+/* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
+
+/* Standard UNIX/Linux (POSIX/SUS base) headers */
+#include <sys/stat.h> /* S_I* */
+#include <sys/types.h> /* mode_t */
+
+#include "libumaskexec.h"
+
+
+char const * umaskexec_parse_mask_octal(char const * mask_string,
+                                        mode_t * mask)
+{
+    mode_t new_mask = 0;
+    char character = *mask_string;
+    do
+    {
+        if(character < '0' || character > '7')
+        {
+            return mask_string;
+        }
+        new_mask <<= 3;
+        new_mask += character - '0';
+        if(new_mask > 0777)
+        {
+            return mask_string;
+        }
+        mask_string += 1;
+        character = *mask_string;
+    }
+    while(character != '\0');
+    *mask = new_mask;
+    return 0;
+}
+
+
+char const * umaskexec_parse_mask_symbolic(char const * mask_string,
+                                           mode_t * mask)
+{
+    /* mask bits combined by permission type: */
+    static mode_t const r_bits = S_IRUSR | S_IRGRP | S_IROTH;
+    static mode_t const w_bits = S_IWUSR | S_IWGRP | S_IWOTH;
+    static mode_t const x_bits = S_IXUSR | S_IXGRP | S_IXOTH;
+
+    /* mask bits combined by who they apply to: */
+    static mode_t const u_bits = S_IRUSR | S_IWUSR | S_IXUSR;
+    static mode_t const g_bits = S_IRGRP | S_IWGRP | S_IXGRP;
+    static mode_t const o_bits = S_IROTH | S_IWOTH | S_IXOTH;
+    static mode_t const a_bits = u_bits | g_bits | o_bits;
+
+    /* new mask starts as the old mask, then is updated: */
+    mode_t new_mask = *mask;
+
+    for(;;)
+    {
+        mode_t u_g_o_a_target = 0;
+        char character;
+
+        for(;;)
+        {
+            character = *mask_string++;
+            if(character == 'u') u_g_o_a_target |= u_bits;
+            else
+            if(character == 'g') u_g_o_a_target |= g_bits;
+            else
+            if(character == 'o') u_g_o_a_target |= o_bits;
+            else
+            if(character == 'a') u_g_o_a_target |= a_bits;
+            else
+            break;
+        }
+
+        if(!u_g_o_a_target)
+        {
+            u_g_o_a_target = a_bits;
+        }
+
+        do
+        {
+            int inverted = 0;
+
+            switch(character)
+            {
+                case '=':
+                    new_mask |= u_g_o_a_target;
+                    /* '=' is the same as '+' after setting the bits */
+                case '+':
+                    new_mask = ~new_mask;
+                    inverted = 1;
+                    /* '+' is the same as '-' once the mask is inverted */
+                case '-':
+                    break;
+                default:
+                    /* mask_string is already past the bad character */
+                    return mask_string - 1;
+            }
+
+            for(;;)
+            {
+                character = *mask_string++;
+
+                /* Symbolic mask '-' sets bits in binary mask. '+' and '=' */
+                /* clear bits, which is setting bits on the inverted mask. */
+
+                if(character == 'r') new_mask |= r_bits & u_g_o_a_target;
+                else
+                if(character == 'w') new_mask |= w_bits & u_g_o_a_target;
+                else
+                if(character == 'x') new_mask |= x_bits & u_g_o_a_target;
+                else
+                break;
+            }
+
+            if(inverted)
+            {
+                new_mask = ~new_mask;
+            }
+
+            if(character == '\0')
+            {
+                *mask = new_mask;
+                return 0;
+            }
+        }
+        while(character != ',');
+    }
+}
+
+
+char const * umaskexec_parse_mask(char const * mask_string, mode_t * mask)
+{
+    char const * error;
+
+    if(!umaskexec_parse_mask_octal(mask_string, mask))
+    {
+        return 0;
+    }
+    error = umaskexec_parse_mask_symbolic(mask_string, mask);
+
+    /* Something starting with a digit was meant to be octal: */
+    if(error && *mask_string >= '0' && *mask_string <= '9')
+    {
+        return umaskexec_parse_mask_octal(mask_string, mask);
+    }
+    return error;
+}
+
+
+char * umaskexec_format_mask_octal(mode_t mask, char * buffer)
+{
+    buffer[0] = '0';
+    buffer[1] = '0' + (7 & (mask >> 6));
+    buffer[2] = '0' + (7 & (mask >> 3));
+    buffer[3] = '0' + (7 & (mask >> 0));
+    buffer[4] = '\0';
+    return buffer + 4;
+}
+
+
+char * umaskexec_format_mask_symbolic(mode_t mask, char * buffer)
+{
+    char * next_character = buffer;
+
+    *next_character++ = 'u';
+    *next_character++ = '=';
+    if(!(mask & S_IRUSR)) *next_character++ = 'r';
+    if(!(mask & S_IWUSR)) *next_character++ = 'w';
+    if(!(mask & S_IXUSR)) *next_character++ = 'x';
+    *next_character++ = ',';
+    *next_character++ = 'g';
+    *next_character++ = '=';
+    if(!(mask & S_IRGRP)) *next_character++ = 'r';
+    if(!(mask & S_IWGRP)) *next_character++ = 'w';
+    if(!(mask & S_IXGRP)) *next_character++ = 'x';
+    *next_character++ = ',';
+    *next_character++ = 'o';
+    *next_character++ = '=';
+    if(!(mask & S_IROTH)) *next_character++ = 'r';
+    if(!(mask & S_IWOTH)) *next_character++ = 'w';
+    if(!(mask & S_IXOTH)) *next_character++ = 'x';
+    *next_character = '\0';
+    return next_character;
+}
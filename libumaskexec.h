@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: 0BSD */
+/* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
+
+#ifndef LIBUMASKEXEC_H
+#define LIBUMASKEXEC_H
+
+/* Standard UNIX/Linux (POSIX/SUS base) headers */
+#include <sys/types.h> /* mode_t */
+
+
+/* Buffer sizes for the formatters, including the terminating '\0': */
+#define UMASKEXEC_OCTAL_SIZE sizeof("0000")
+#define UMASKEXEC_SYMBOLIC_SIZE sizeof("u=rwx,g=rwx,o=rwx")
+
+
+/* The parsers never touch the process umask, so they are reentrant.   */
+/* *mask holds the old mask on entry (symbolic masks are relative to   */
+/* it), and the new mask on success. On success they return a null     */
+/* pointer; on failure they return a pointer to the offending          */
+/* character in mask_string and leave *mask unchanged.                 */
+
+char const * umaskexec_parse_mask_octal(char const * mask_string,
+                                        mode_t * mask);
+
+char const * umaskexec_parse_mask_symbolic(char const * mask_string,
+                                           mode_t * mask);
+
+/* Octal if it parses as octal, otherwise symbolic: */
+char const * umaskexec_parse_mask(char const * mask_string, mode_t * mask);
+
+
+/* The formatters write a '\0'-terminated string into buffer, which    */
+/* must be at least UMASKEXEC_*_SIZE bytes long, and return a pointer  */
+/* to the terminating '\0', so more can be appended cheaply.           */
+
+char * umaskexec_format_mask_octal(mode_t mask, char * buffer);
+
+char * umaskexec_format_mask_symbolic(mode_t mask, char * buffer);
+
+#endif /* LIBUMASKEXEC_H */
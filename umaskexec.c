@@ -1,16 +1,78 @@
 /* SPDX-License-Identifier: 0BSD */
 /* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
 
+#define _POSIX_C_SOURCE 200809L
+#ifdef __linux__
+#define _GNU_SOURCE /* CPU_*, O_PATH, sched_setaffinity, syscall */
+#endif
+
 /* Standard C library headers */
-#include <errno.h> /* errno */
-#include <stdio.h> /* EOF, fputc, fputs, perror, stderr, stdout */
-#include <stdlib.h> /* EXIT_FAILURE, EXIT_SUCCESS */
-#include <string.h> /* strcmp */
+#include <errno.h> /* E*, errno */
+#include <limits.h> /* CHAR_BIT, INT_MAX */
+#include <signal.h> /* SIG*, kill, raise, sig*, signal */
+#include <stdlib.h> /* EXIT_*, free, getenv, malloc, realloc */
+#include <string.h> /* mem*, str*, strerror */
 
 /* Standard UNIX/Linux (POSIX/SUS base) headers */
-#include <sys/stat.h> /* umask */
-#include <sys/types.h> /* mode_t */
-#include <unistd.h> /* execvp */
+#include <dirent.h> /* DIR, closedir, fdopendir, readdir, struct dirent */
+#include <fcntl.h> /* AT_*, FD_CLOEXEC, F_SET*, O_*, fcntl, fchmodat, ... */
+#include <poll.h> /* POLLIN, poll, struct pollfd */
+#include <pthread.h> /* pthread_* */
+#include <spawn.h> /* posix_spawn*, POSIX_SPAWN_SETSIGMASK */
+#include <sys/resource.h> /* PRIO_*, RL*, RUSAGE_CHILDREN, getrusage, ... */
+#include <sys/socket.h> /* AF_UNIX, CMSG_*, MSG_*, SCM_RIGHTS, accept, ... */
+#include <sys/stat.h> /* S_IS*, fchmod, fstatat, stat, struct stat, umask */
+#include <sys/time.h> /* struct timeval */
+#include <sys/types.h> /* mode_t, pid_t, ssize_t */
+#include <sys/un.h> /* struct sockaddr_un */
+#include <sys/wait.h> /* WEXITSTATUS, WIF*, WNOHANG, WTERMSIG, waitpid */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+#include <unistd.h> /* STD*_FILENO, X_OK, access, execvp, pipe, read, ... */
+
+#ifdef __linux__
+#include <linux/mempolicy.h> /* MPOL_BIND, MPOL_INTERLEAVE */
+#include <linux/perf_event.h> /* PERF_*, __u64, struct perf_event_attr */
+#include <linux/sched.h> /* CLONE_INTO_CGROUP, struct clone_args */
+#include <sched.h> /* CPU_*, SCHED_*, cpu_set_t, sched_set*, struct ... */
+#include <sys/mman.h> /* MAP_*, PROT_*, mmap, munmap */
+#include <sys/syscall.h> /* SYS_clone3, SYS_close_range, SYS_perf_..., ... */
+/* The io_uring rings are shared with the kernel through memory, and */
+/* need GCC's atomic builtins for the ordering of their head and tail */
+#if defined(__has_include) && defined(__GNUC__)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h> /* IORING_*, struct io_uring_* */
+/* IORING_OP_STATX is an enum, so a macro from the same 5.6 headers */
+/* tells whether it is there, instead of failing the build:         */
+#ifdef IORING_FEAT_CUR_PERSONALITY
+#define URING 1
+#endif
+#endif
+#endif
+#endif
+
+/* USDT probes, for bpftrace or perf to attach to, where <sys/sdt.h> */
+/* exists. Nested, because #if has to parse on compilers without     */
+/* __has_include. A probe nobody is attached to is a single nop.     */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h> /* DTRACE_PROBE* */
+#define PROBES 1
+#endif
+#endif
+
+#include "libumaskexec.h"
+
+
+extern char * * environ;
+
+
+#ifdef PROBES
+#define PROBE1(name, a) DTRACE_PROBE1(umaskexec, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(umaskexec, name, a, b)
+#else
+#define PROBE1(name, a) ((void)(a))
+#define PROBE2(name, a, b) ((void)(a), (void)(b))
+#endif
 
 
 char const version_text[] = "umaskexec 1.0.0\n";
@@ -21,13 +83,99 @@ char const help_text[] =
     "If no command is given, show what mask would be used.\n"
     "\n"
     "Usage:\n"
-    "    umaskexec [--symbolic | --] [<mask> [<command> [<argument>]...]]\n"
+    "    umaskexec [<option>]... [--] [<mask> [<command> [<argument>]...]]\n"
+    "    umaskexec --batch <file> [<option>]... [--] [<mask>]\n"
+    "    umaskexec (--check | --convert) [<option>]... [--] [<mask>]\n"
+    "    umaskexec --apply-tree <directory> [<option>]... [--] [<mask>]\n"
+    "    umaskexec --serve <socket> [<option>]... [--] [<mask>]\n"
     "    umaskexec (--help | --version) [<ignored>]...\n"
     "\n"
     "Options:\n"
     "    -h --help      show this help text\n"
     "    -V --version   show version information\n"
     "    -S --symbolic  show the mask symbolically instead of in octal\n"
+    "       --spawn     run the command as a child, wait, and exit like it\n"
+    "       --init      like --spawn, also forward signals and reap zombies\n"
+    "       --batch <file>\n"
+    "                   run \"<mask> <command> [<argument>]...\" lines from\n"
+    "                   <file> (\"-\" for stdin), reporting each exit status\n"
+    "                   (relative masks are relative to <mask>, if given)\n"
+    "       --serve <socket>\n"
+    "                   listen on the unix <socket> as a spawn server,\n"
+    "                   with child processes forked ahead of time with\n"
+    "                   the mask and setup applied, each to exec just one\n"
+    "                   command sent with --via, and report its status\n"
+    "       --via <socket>\n"
+    "                   have the --serve server at <socket> run the\n"
+    "                   command with this process's stdio, directory,\n"
+    "                   environment and mask, wait, and exit like it\n"
+    "       --status-fd <fd>\n"
+    "                   write --batch exit statuses to <fd> instead of\n"
+    "                   stdout, which the commands write to as well\n"
+    "    -0 --null      batch fields end with a null, records with an empty\n"
+    "                   field, instead of blanks and newlines; --check and\n"
+    "                   --convert masks end with a null, not a newline\n"
+    "       --fd <fd>   execute the already opened file <fd>, with <command>\n"
+    "                   as just its name, instead of searching PATH\n"
+    "       --dirfd <fd>\n"
+    "                   execute <command> relative to the already opened\n"
+    "                   directory <fd>, instead of searching PATH\n"
+    "       --chdir <directory>\n"
+    "                   change to <directory> (before opening --batch)\n"
+    "       --setenv <name>=<value>\n"
+    "       --unsetenv <name>\n"
+    "                   set or remove an environment variable\n"
+    "       --rlimit <resource>=<soft>[:<hard>]\n"
+    "                   set a resource limit, like nofile=4096:65536\n"
+    "                   (<soft> and <hard> can be \"unlimited\")\n"
+    "       --close-fds close all open files except stdin, stdout, stderr\n"
+    "                   and those given to other options, or in\n"
+    "                   UMASKEXEC_TRACE_FD\n"
+    "       --cpus <list>\n"
+    "                   run on only the CPUs in <list>, like \"0-3,8\"\n"
+    "       --membind <list>\n"
+    "                   allocate memory only from the NUMA nodes in <list>\n"
+    "       --interleave <list>\n"
+    "                   interleave memory across the NUMA nodes in <list>\n"
+    "       --cgroup <directory>\n"
+    "                   run the command as a child which starts in the\n"
+    "                   cgroup (v2) <directory>, wait, and exit like it\n"
+    "       --nice <n>  set the nice value to <n>, from -20 to 19\n"
+    "       --ioprio <class>[:<level>]\n"
+    "                   set the I/O priority: none, realtime, best-effort\n"
+    "                   or idle, at <level> 0 (highest) to 7 (default 4,\n"
+    "                   or 0 for none and idle)\n"
+    "       --sched <policy>[:<priority>]\n"
+    "                   set the scheduling policy: other, batch, idle,\n"
+    "                   fifo or rr, at static <priority> (default 0, or\n"
+    "                   1 for fifo and rr, which take 1 to 99)\n"
+    "       --rusage <fd>\n"
+    "                   like --spawn, then write the command's resource\n"
+    "                   usage to <fd> as one line of <key>=<value> fields\n"
+    "       --perf-stat <fd>\n"
+    "                   like --rusage, also with the task-clock, context\n"
+    "                   switch, page fault, and (where available) cycle,\n"
+    "                   instruction and cache miss counts of the command\n"
+    "       --check     check masks read from stdin, one per line, and\n"
+    "                   report bad ones, without changing the mask\n"
+    "                   (relative masks are relative to <mask>, if given)\n"
+    "       --convert   like --check, also writing each good mask to\n"
+    "                   stdout in octal, or symbolically with -S\n"
+    "       --apply-tree <directory>\n"
+    "                   take the bits the mask forbids away from every\n"
+    "                   file in <directory>, itself included, using a\n"
+    "                   thread per CPU, then report the inodes per second\n"
+    "                   on stderr\n"
+    "       --dry-run   with --apply-tree, only list the files which have\n"
+    "                   forbidden bits, instead of changing them\n"
+    "       --io-uring  with --apply-tree, stat files in batches with\n"
+    "                   io_uring where the kernel allows it, which is\n"
+    "                   faster on network and overlay file systems\n"
+    "       --args0     like xargs -0: run the command with null-terminated\n"
+    "                   arguments from stdin appended, as many as fit\n"
+    "    -j --jobs <n>  run up to <n> --batch or --args0 jobs at once, use\n"
+    "                   <n> --apply-tree threads, or keep <n> --serve\n"
+    "                   child processes ready\n"
     "\n"
     "Format:\n"
     "    <mask>         <octal> | <symbolic>[,<symbolic>]...\n"
@@ -37,20 +185,71 @@ char const help_text[] =
     "\n"
     "Errors:\n"
     "    bad option: <option>\n"
+    "    missing option argument: <option>\n"
+    "    bad option argument: <option> <argument>\n"
     "    bad mask: <mask>\n"
     "    error writing output: <...>\n"
     "    error executing command: <command>: <...>\n"
+    "    error waiting for command: <...>\n"
+    "    error reading batch: <file>: <...>\n"
+    "    error reading input: <...>\n"
+    "    error serving: <socket>: <...>\n"
+    "    error reaching server: <socket>: <...>\n"
+    "    error setting <setting>: <...>\n"
+    "    argument too long\n"
+    "    record <number>: <error>\n"
+    "    line <number>: bad mask: <mask>\n"
+    "    error applying mask: <file>: <...>\n"
 ;
 
 
+/* Output goes straight to write(2): this process writes at most a */
+/* few lines, so stdio buffering would only add startup cost.      */
+
+static
+int write_string(int fd, char const * string)
+{
+    size_t length = strlen(string);
+    while(length)
+    {
+        ssize_t written = write(fd, string, length);
+        if(written == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        string += written;
+        length -= written;
+    }
+    return 1;
+}
+
+
+/* Like perror, but without stdio: */
+static
+void write_perror(char const * prefix)
+{
+    char const * message = strerror(errno);
+    if(write_string(STDERR_FILENO, prefix)
+    && write_string(STDERR_FILENO, ": ")
+    && write_string(STDERR_FILENO, message))
+    {
+        write_string(STDERR_FILENO, "\n");
+    }
+}
+
+
 static
 int error_bad_option(char * option, char * arg0)
 {
-    if(fputs(arg0, stderr) != EOF
-    && fputs(": bad option: ", stderr) != EOF
-    && fputs(option, stderr) != EOF)
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": bad option: ")
+    && write_string(STDERR_FILENO, option))
     {
-        fputc('\n', stderr);
+        write_string(STDERR_FILENO, "\n");
     }
     return EXIT_FAILURE;
 }
@@ -60,10 +259,10 @@ static
 int error_writing_output(char * arg0)
 {
     int errno_ = errno;
-    if(fputs(arg0, stderr) != EOF)
+    if(write_string(STDERR_FILENO, arg0))
     {
         errno = errno_;
-        perror(": error writing output");
+        write_perror(": error writing output");
     }
     return EXIT_FAILURE;
 }
@@ -72,11 +271,11 @@ int error_writing_output(char * arg0)
 static
 int error_bad_mask(char * mask_string, char * arg0)
 {
-    if(fputs(arg0, stderr) != EOF
-    && fputs(": bad mask: ", stderr) != EOF
-    && fputs(mask_string, stderr) != EOF)
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": bad mask: ")
+    && write_string(STDERR_FILENO, mask_string))
     {
-        fputc('\n', stderr);
+        write_string(STDERR_FILENO, "\n");
     }
     return EXIT_FAILURE;
 }
@@ -86,11 +285,95 @@ static
 int error_executing_command(char * command, char * arg0)
 {
     int errno_ = errno;
-    if(fputs(arg0, stderr) != EOF
-    && fputs(": error executing command: ", stderr) != EOF)
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": error executing command: "))
+    {
+        errno = errno_;
+        write_perror(command);
+    }
+    return EXIT_FAILURE;
+}
+
+
+static
+int error_missing_option_argument(char * option, char * arg0)
+{
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": missing option argument: ")
+    && write_string(STDERR_FILENO, option))
+    {
+        write_string(STDERR_FILENO, "\n");
+    }
+    return EXIT_FAILURE;
+}
+
+
+static
+int error_bad_option_argument(char * option, char * argument, char * arg0)
+{
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": bad option argument: ")
+    && write_string(STDERR_FILENO, option)
+    && write_string(STDERR_FILENO, " ")
+    && write_string(STDERR_FILENO, argument))
+    {
+        write_string(STDERR_FILENO, "\n");
+    }
+    return EXIT_FAILURE;
+}
+
+
+static
+int error_reading_batch(char * file, char * arg0)
+{
+    int errno_ = errno;
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": error reading batch: "))
+    {
+        errno = errno_;
+        write_perror(file);
+    }
+    return EXIT_FAILURE;
+}
+
+
+static
+int error_serving(char * socket_path, char * arg0)
+{
+    int errno_ = errno;
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": error serving: "))
+    {
+        errno = errno_;
+        write_perror(socket_path);
+    }
+    return EXIT_FAILURE;
+}
+
+
+static
+int error_setting(char * setting, char * arg0)
+{
+    int errno_ = errno;
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": error setting "))
+    {
+        errno = errno_;
+        write_perror(setting);
+    }
+    return 0;
+}
+
+
+static
+int error_reaching_server(char * socket_path, char * arg0)
+{
+    int errno_ = errno;
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": error reaching server: "))
     {
         errno = errno_;
-        perror(command);
+        write_perror(socket_path);
     }
     return EXIT_FAILURE;
 }
@@ -99,8 +382,7 @@ int error_executing_command(char * command, char * arg0)
 static
 int print_help(char * arg0)
 {
-    if(fputs(help_text, stdout) == EOF
-    || fflush(stdout) == EOF)
+    if(!write_string(STDOUT_FILENO, help_text))
     {
         return error_writing_output(arg0);
     }
@@ -111,8 +393,7 @@ int print_help(char * arg0)
 static
 int print_version(char * arg0)
 {
-    if(fputs(version_text, stdout) == EOF
-    || fflush(stdout) == EOF)
+    if(!write_string(STDOUT_FILENO, version_text))
     {
         return error_writing_output(arg0);
     }
@@ -123,14 +404,12 @@ int print_version(char * arg0)
 static
 int print_mask_octal(char * arg0)
 {
-    char mask_string[] = "0000\n";
-    mode_t mask = umask(0);
-    mask_string[1] += 7 & (mask >> 6);
-    mask_string[2] += 7 & (mask >> 3);
-    mask_string[3] += 7 & (mask >> 0);
+    char mask_string[UMASKEXEC_OCTAL_SIZE + 1];
+    char * end = umaskexec_format_mask_octal(umask(0), mask_string);
+    end[0] = '\n';
+    end[1] = '\0';
 
-    if(fputs(mask_string, stdout) == EOF
-    || fflush(stdout) == EOF)
+    if(!write_string(STDOUT_FILENO, mask_string))
     {
         return error_writing_output(arg0);
     }
@@ -141,32 +420,12 @@ int print_mask_octal(char * arg0)
 static
 int print_mask_symbolic(char * arg0)
 {
-    char mask_string[sizeof("u=rwx,g=rwx,o=rwx\n")];
-    char * next_character = mask_string;
-    mode_t mask = umask(0);
+    char mask_string[UMASKEXEC_SYMBOLIC_SIZE + 1];
+    char * end = umaskexec_format_mask_symbolic(umask(0), mask_string);
+    end[0] = '\n';
+    end[1] = '\0';
 
-    *next_character++ = 'u';
-    *next_character++ = '=';
-    if(!(mask & S_IRUSR)) *next_character++ = 'r';
-    if(!(mask & S_IWUSR)) *next_character++ = 'w';
-    if(!(mask & S_IXUSR)) *next_character++ = 'x';
-    *next_character++ = ',';
-    *next_character++ = 'g';
-    *next_character++ = '=';
-    if(!(mask & S_IRGRP)) *next_character++ = 'r';
-    if(!(mask & S_IWGRP)) *next_character++ = 'w';
-    if(!(mask & S_IXGRP)) *next_character++ = 'x';
-    *next_character++ = ',';
-    *next_character++ = 'o';
-    *next_character++ = '=';
-    if(!(mask & S_IROTH)) *next_character++ = 'r';
-    if(!(mask & S_IWOTH)) *next_character++ = 'w';
-    if(!(mask & S_IXOTH)) *next_character++ = 'x';
-    *next_character++ = '\n';
-    *next_character = '\0';
-
-    if(fputs(mask_string, stdout) == EOF
-    || fflush(stdout) == EOF)
+    if(!write_string(STDOUT_FILENO, mask_string))
     {
         return error_writing_output(arg0);
     }
@@ -175,215 +434,5032 @@ int print_mask_symbolic(char * arg0)
 
 
 static
-int parse_and_use_mask_octal(char * mask_string)
+int parse_and_use_mask(char * mask_string)
+{
+    mode_t old_mask;
+    mode_t mask;
+
+    /* Octal masks do not depend on the old mask, so skip reading it: */
+    if(!umaskexec_parse_mask_octal(mask_string, &mask))
+    {
+        old_mask = umask(mask);
+        PROBE2(mask, old_mask, mask);
+        return 1;
+    }
+
+    /* new mask starts as the old mask, then is updated: */
+    old_mask = mask = umask(0);
+    if(!umaskexec_parse_mask_symbolic(mask_string, &mask))
+    {
+        umask(mask);
+        PROBE2(mask, old_mask, mask);
+        return 1;
+    }
+    PROBE1(bad_mask, mask_string);
+    return 0;
+}
+
+
+/* Strictly decimal, unlike atoi or strtoul, and range checked. */
+/* Returns a pointer past the digits, or a null pointer if none.  */
+static
+char const * parse_digits(char const * string, unsigned long maximum,
+                          unsigned long * number)
 {
-    mode_t new_mask = 0;
-    char character = *mask_string;
+    unsigned long value = 0;
+    if(*string < '0' || *string > '9')
+    {
+        return 0;
+    }
     do
     {
-        if(character < '0' || character > '7')
-        {
-            return 0;
-        }
-        new_mask <<= 3;
-        new_mask += character - '0';
-        if(new_mask > 0777)
+        unsigned long digit = *string - '0';
+        if(digit > maximum || value > (maximum - digit) / 10)
         {
             return 0;
         }
-        mask_string += 1;
-        character = *mask_string;
+        value = value * 10 + digit;
+        string += 1;
+    }
+    while(*string >= '0' && *string <= '9');
+    *number = value;
+    return string;
+}
+
+
+static
+int parse_number(char const * string, unsigned long minimum,
+                 unsigned long maximum, unsigned long * number)
+{
+    unsigned long value;
+    string = parse_digits(string, maximum, &value);
+    if(!string || *string || value < minimum)
+    {
+        return 0;
     }
-    while(character != '\0');
-    umask(new_mask);
+    *number = value;
     return 1;
 }
 
 
+/* Formats number in decimal, returning a pointer to the terminating */
+/* '\0'. Digits of an unsigned long fit in 3 per byte, plus a '\0'.  */
+#define NUMBER_SIZE (sizeof(unsigned long) * 3 + 1)
+
 static
-int parse_and_use_mask_symbolic(char * mask_string)
+char * format_number(unsigned long number, char * buffer)
 {
-    /* mask bits combined by permission type: */
-    static mode_t const r_bits = S_IRUSR | S_IRGRP | S_IROTH;
-    static mode_t const w_bits = S_IWUSR | S_IWGRP | S_IWOTH;
-    static mode_t const x_bits = S_IXUSR | S_IXGRP | S_IXOTH;
+    char digits[NUMBER_SIZE];
+    char * digit = digits;
+    do
+    {
+        *digit++ = '0' + number % 10;
+        number /= 10;
+    }
+    while(number);
+    while(digit != digits)
+    {
+        *buffer++ = *--digit;
+    }
+    *buffer = '\0';
+    return buffer;
+}
 
-    /* mask bits combined by who they apply to: */
-    static mode_t const u_bits = S_IRUSR | S_IWUSR | S_IXUSR;
-    static mode_t const g_bits = S_IRGRP | S_IWGRP | S_IXGRP;
-    static mode_t const o_bits = S_IROTH | S_IWOTH | S_IXOTH;
-    static mode_t const a_bits = u_bits | g_bits | o_bits;
 
-    /* new mask starts as the old mask, then is updated: */
-    mode_t new_mask = umask(0);
+/* Phase timing for slow launches: if UMASKEXEC_TRACE_FD is the number */
+/* of an open fd, named points are timestamped into a buffer, which is */
+/* written as one line with one write just before each exec, since    */
+/* nothing can be written after a successful one. Lines look like      */
+/*                                                                     */
+/*     pid=42 entry=81234567890 options=+2100 mask=+3300 exec=+4100:ls */
+/*                                                                     */
+/* with the entry in CLOCK_MONOTONIC nanoseconds, the rest relative to */
+/* it, and failed exec attempts as "failed=+<nanoseconds>:<errno>".    */
+static struct
+{
+    int on;
+    int fd;
+    struct timespec entry;
+    char * end;
+    char buffer[4096];
+}
+trace;
 
-    for(;;)
+
+static
+void trace_start(void)
+{
+    char const * fd_string = getenv("UMASKEXEC_TRACE_FD");
+    unsigned long fd;
+
+    if(!fd_string || !parse_number(fd_string, 0, INT_MAX, &fd))
     {
-        mode_t u_g_o_a_target = 0;
-        char character;
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &trace.entry);
+    trace.on = 1;
+    trace.fd = fd;
+    trace.end = trace.buffer;
+}
 
-        for(;;)
-        {
-            character = *mask_string++;
-            if(character == 'u') u_g_o_a_target |= u_bits;
-            else
-            if(character == 'g') u_g_o_a_target |= g_bits;
-            else
-            if(character == 'o') u_g_o_a_target |= o_bits;
-            else
-            if(character == 'a') u_g_o_a_target |= a_bits;
-            else
-            break;
-        }
 
-        if(!u_g_o_a_target)
-        {
-            u_g_o_a_target = a_bits;
-        }
+static
+char * copy_string(char * buffer, char const * string)
+{
+    size_t length = strlen(string);
+    memcpy(buffer, string, length);
+    return buffer + length;
+}
 
-        do
-        {
-            int inverted = 0;
 
-            switch(character)
-            {
-                case '=':
-                    new_mask |= u_g_o_a_target;
-                    /* '=' is the same as '+' after setting the bits */
-                case '+':
-                    new_mask = ~new_mask;
-                    inverted = 1;
-                    /* '+' is the same as '-' once the mask is inverted */
-                case '-':
-                    break;
-                default:
-                    return 0;
-            }
+static
+void trace_flush(void)
+{
+    char line[sizeof(trace.buffer) + 64];
+    char * end = line;
 
-            for(;;)
-            {
-                character = *mask_string++;
+    if(!trace.on || trace.end == trace.buffer)
+    {
+        return;
+    }
+    end = copy_string(end, "pid=");
+    end = format_number(getpid(), end);
+    end = copy_string(end, " entry=");
+    end = format_number(trace.entry.tv_sec * 1000000000UL
+                        + trace.entry.tv_nsec, end);
+    memcpy(end, trace.buffer, trace.end - trace.buffer);
+    end += trace.end - trace.buffer;
+    *end++ = '\n';
+    trace.end = trace.buffer;
 
-                /* Symbolic mask '-' sets bits in binary mask. '+' and '=' */
-                /* clear bits, which is setting bits on the inverted mask. */
+    /* Tracing must never stop the command from running: */
+    if(write(trace.fd, line, end - line))
+    {
+    }
+}
 
-                if(character == 'r') new_mask |= r_bits & u_g_o_a_target;
-                else
-                if(character == 'w') new_mask |= w_bits & u_g_o_a_target;
-                else
-                if(character == 'x') new_mask |= x_bits & u_g_o_a_target;
-                else
-                break;
-            }
 
-            if(inverted)
-            {
-                new_mask = ~new_mask;
-            }
+/* Adds " <name>=+<nanoseconds>", and ":<detail>" if there is one: */
+static
+void trace_point(char const * name, char const * detail)
+{
+    struct timespec now;
+    size_t room;
 
-            if(character == '\0')
-            {
-                umask(new_mask);
-                return 1;
-            }
+    if(!trace.on)
+    {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    room = strlen(name) + NUMBER_SIZE + 4;
+    if(detail)
+    {
+        room += strlen(detail);
+    }
+    if(room > (size_t)(trace.buffer + sizeof(trace.buffer) - trace.end))
+    {
+        trace_flush();
+        if(room > sizeof(trace.buffer))
+        {
+            detail = 0;
         }
-        while(character != ',');
+    }
+
+    *trace.end++ = ' ';
+    trace.end = copy_string(trace.end, name);
+    trace.end = copy_string(trace.end, "=+");
+    trace.end = format_number((now.tv_sec - trace.entry.tv_sec) * 1000000000UL
+                              + now.tv_nsec - trace.entry.tv_nsec, trace.end);
+    if(detail)
+    {
+        *trace.end++ = ':';
+        trace.end = copy_string(trace.end, detail);
     }
 }
 
 
 static
-int parse_and_use_mask(char * mask_string)
+void trace_exec(char * file, char * * argv)
 {
-    if(parse_and_use_mask_octal(mask_string)
-    || parse_and_use_mask_symbolic(mask_string))
+    char errno_string[NUMBER_SIZE];
+    trace_point("exec", file);
+    trace_flush();
+    PROBE1(exec, file);
+    execve(file, argv, environ);
+    PROBE2(exec_failed, file, errno);
+    format_number(errno, errno_string);
+    trace_point("failed", errno_string);
+}
+
+
+/* Like execvp, a file which is not in a known executable format is */
+/* run with sh, which is given the file in place of the command name. */
+/* Returns the arguments for that from malloc, or a null pointer:     */
+static
+char * * new_sh_argv(char * file, char * * argv)
+{
+    char * * sh_argv;
+    size_t count = 1;
+
+    while(argv[count - 1])
     {
-        return 1;
+        count += 1;
     }
-    return 0;
+    sh_argv = malloc((count + 1) * sizeof(char *));
+    if(sh_argv)
+    {
+        sh_argv[0] = "sh";
+        sh_argv[1] = file;
+        memcpy(sh_argv + 2, argv + 1, (count - 1) * sizeof(char *));
+    }
+    return sh_argv;
 }
 
 
-int main(int argc, char * * argv)
+static
+void trace_exec_or_sh(char * file, char * * argv)
 {
-    char * arg;
-    char * arg0 = *argv;
-
-    /* Function pointer holds octal or symbolic mask printing choice: */
-    int (* print_mask)(char * arg0) = print_mask_octal;
+    char * * sh_argv;
 
-    /* Without any arguments (two, counting argv[0]), just print the mask: */
-    if(argc < 2)
+    trace_exec(file, argv);
+    if(errno != ENOEXEC)
     {
-        /* Many systems allow execution without even the zeroth argument: */
-        if(!arg0)
-        {
-            arg0 = "";
-        }
-        return print_mask(arg0);
+        return;
+    }
+    sh_argv = new_sh_argv(file, argv);
+    if(sh_argv)
+    {
+        trace_exec("/bin/sh", sh_argv);
+        free(sh_argv);
     }
+    errno = ENOEXEC;
+}
 
-    /* The goal is to shift argv until it points to the command to execute: */
-    argv += 1;
 
-    /* First argument is either an option (starts with '-') or the mask: */
-    arg = *argv;
+/* Like execvp, but with every attempt traced, and probed: */
+static
+void trace_execvp(char * * argv)
+{
+    char const * path = getenv("PATH");
+    size_t command_length = strlen(*argv);
+    int denied = 0;
 
-    if(*arg == '-')
+    if(strchr(*argv, '/'))
     {
-        arg += 1;
-        if(!strcmp(arg, "-help") || !strcmp(arg, "h"))
+        trace_exec_or_sh(*argv, argv);
+        return;
+    }
+    if(!path)
+    {
+        path = "/bin:/usr/bin";
+    }
+    for(;;)
+    {
+        char const * end = strchr(path, ':');
+        size_t directory_length;
+        char * candidate;
+        int errno_;
+
+        if(!end)
         {
-            return print_help(arg0);
+            end = path + strlen(path);
         }
-        if(!strcmp(arg, "-version") || !strcmp(arg, "V"))
+        directory_length = end - path;
+        candidate = malloc(directory_length + command_length + 3);
+        if(!candidate)
         {
-            return print_version(arg0);
+            return;
         }
-
-        if(!strcmp(arg, "-symbolic") || !strcmp(arg, "S"))
+        /* An empty PATH entry means the current directory: */
+        if(directory_length)
         {
-            print_mask = print_mask_symbolic;
+            memcpy(candidate, path, directory_length);
         }
         else
-        /* If it is *not* the "end of options" ("--") "option": */
-        if(strcmp(arg, "-"))
         {
-            return error_bad_option(arg - 1, arg0);
+            candidate[0] = '.';
+            directory_length = 1;
         }
+        candidate[directory_length] = '/';
+        memcpy(candidate + directory_length + 1, *argv, command_length + 1);
 
-        /* Shift argv past the consumed option, leaving the mask: */
-        argv += 1;
-        arg = *argv;
+        trace_exec_or_sh(candidate, argv);
+        errno_ = errno;
+        free(candidate);
+        errno = errno_;
 
-        /* No more arguments after parsing options? Print the mask: */
-        if(!arg)
+        /* Like execvp, keep going only if the command could be later: */
+        if(errno == EACCES)
+        {
+            denied = 1;
+        }
+        else
+        if(errno != ENOENT && errno != ENOTDIR && errno != ESTALE
+        && errno != ENODEV && errno != ETIMEDOUT)
+        {
+            return;
+        }
+        if(!*end)
         {
-            return print_mask(arg0);
+            break;
         }
+        path = end + 1;
     }
+    if(denied)
+    {
+        errno = EACCES;
+    }
+}
 
-    /* Now arg should be the mask. */
 
-    if(!parse_and_use_mask(arg))
+static
+int execute_command(char * * argv, char * arg0)
+{
+    /* Only tracing needs each attempt of the PATH search, and probes */
+    /* are no reason to give up the libc one, so they are fired just   */
+    /* around it, with the command as given:                           */
+    if(trace.on)
     {
-        return error_bad_mask(arg, arg0);
+        trace_execvp(argv);
+        trace_flush();
+    }
+    else
+    {
+        PROBE1(exec, *argv);
+        execvp(*argv, argv);
+        PROBE2(exec_failed, *argv, errno);
     }
+    /* If we're here, execvp failed to execute the command. */
 
-    /* Shift argv past the mask, leaving just the command in argv: */
-    argv += 1;
+    return error_executing_command(*argv, arg0);
+}
 
-    arg = *argv;
-    /* Now arg should be the command to execute. */
 
-    if(!arg)
+/* Opening for exec only needs execute permission where O_PATH exists. */
+/* It is not close-on-exec, since the interpreter named by a "#!" line */
+/* opens the script by its /dev/fd name after the exec:                */
+#ifdef O_PATH
+#define EXEC_OPEN_FLAGS O_PATH
+#else
+#define EXEC_OPEN_FLAGS O_RDONLY
+#endif
+
+/* Executes an already opened file, or one opened relative to an    */
+/* already opened directory, so there is no PATH search, and the    */
+/* file executed is the one the caller checked, not whatever is at  */
+/* its path by the time of the exec.                                */
+static
+int execute_fd(int fd, int directory_fd, char * * argv, char * arg0)
+{
+    trace_point("exec", *argv);
+    trace_flush();
+    PROBE1(exec, *argv);
+    if(directory_fd == -1)
     {
-        /* If no command was given, just print the new mask: */
-        return print_mask(arg0);
+        fexecve(fd, argv, environ);
     }
-
-    execvp(arg, argv);
-    /* If we're here, execvp failed to execute the command. */
-
-    return error_executing_command(arg, arg0);
+    else
+    {
+#ifdef SYS_execveat
+        /* Without an fd to leak into the command, or to open first: */
+        syscall(SYS_execveat, directory_fd, *argv, argv, environ, 0);
+        if(errno == ENOSYS)
+#endif
+        {
+            fd = openat(directory_fd, *argv, EXEC_OPEN_FLAGS);
+            if(fd != -1)
+            {
+                fexecve(fd, argv, environ);
+            }
+        }
+    }
+    /* If we're here, the command could not be executed. */
+    PROBE2(exec_failed, *argv, errno);
+
+    /* Like execvp, sh runs a file in no known executable format, by */
+    /* a name which reaches the same file through the open fd:       */
+    if(errno == ENOEXEC)
+    {
+        char * file = malloc(sizeof("/dev/fd//") + NUMBER_SIZE
+                             + strlen(*argv));
+        char * * sh_argv = 0;
+        if(file)
+        {
+            char * end = copy_string(file, "/dev/fd/");
+            end = format_number(directory_fd == -1 ? fd : directory_fd,
+                                end);
+            if(directory_fd != -1)
+            {
+                *end++ = '/';
+                copy_string(end, *argv)[0] = '\0';
+            }
+            /* execveat ignores the directory for absolute paths: */
+            sh_argv = new_sh_argv(directory_fd != -1 && **argv == '/'
+                                  ? *argv : file, argv);
+        }
+        if(sh_argv)
+        {
+            trace_exec("/bin/sh", sh_argv);
+            free(sh_argv);
+        }
+        free(file);
+        errno = ENOEXEC;
+    }
+
+    return error_executing_command(*argv, arg0);
+}
+
+
+static
+int error_waiting_for_command(char * arg0)
+{
+    int errno_ = errno;
+    if(write_string(STDERR_FILENO, arg0))
+    {
+        errno = errno_;
+        write_perror(": error waiting for command");
+    }
+    return EXIT_FAILURE;
+}
+
+
+static
+int exit_like_signal(int signal_number)
+{
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+    /* If we're here, the signal is blocked or does not kill. */
+    return 128 + signal_number;
+}
+
+
+/* Exit the way the child did, so callers cannot tell the difference: */
+static
+int exit_like(int status)
+{
+    if(WIFSIGNALED(status))
+    {
+        return exit_like_signal(WTERMSIG(status));
+    }
+    return WEXITSTATUS(status);
+}
+
+
+#ifdef __linux__
+/* Counters for --perf-stat, with their keys in the report: */
+static struct
+{
+    char const * key;
+    __u32 type;
+    __u64 config;
+}
+const perf_counters[] = {
+    {" task_clock_ns=", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {" context_switches=", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {" page_faults=", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {" cycles=", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {" instructions=", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {" cache_misses=", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}
+};
+#define PERF_COUNTER_COUNT (sizeof(perf_counters) / sizeof(*perf_counters))
+#endif
+
+/* Where to report the resource usage of commands, if anywhere, and */
+/* when they were started, for the wall clock time:                 */
+static struct
+{
+    int fd;
+    struct timespec start;
+#ifdef __linux__
+    /* With --perf-stat, counter fds, each -1 if it is unavailable: */
+    int perf_stat;
+    int perf_fds[PERF_COUNTER_COUNT];
+#endif
+}
+report;
+
+
+static
+char * append_field(char * line, char const * key, unsigned long value)
+{
+    size_t length = strlen(key);
+    memcpy(line, key, length);
+    return format_number(value, line + length);
+}
+
+
+static
+unsigned long microseconds(struct timeval * time)
+{
+    return time->tv_sec * 1000000UL + time->tv_usec;
+}
+
+
+#ifdef __linux__
+/* Opens the counters on a child which has not exec'd yet: they start */
+/* counting at its exec, and also count its descendants. Counters the */
+/* hardware, a VM or perf_event_paranoid does not allow are skipped.  */
+static
+void open_counters(pid_t pid)
+{
+    unsigned int counter;
+    for(counter = 0; counter < PERF_COUNTER_COUNT; counter += 1)
+    {
+        struct perf_event_attr attr;
+        int fd;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_counters[counter].type;
+        attr.config = perf_counters[counter].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                         | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.inherit = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+                     PERF_FLAG_FD_CLOEXEC);
+        if(fd == -1)
+        {
+            /* Unprivileged, kernel counting is usually not allowed: */
+            attr.exclude_kernel = 1;
+            fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+                         PERF_FLAG_FD_CLOEXEC);
+        }
+        report.perf_fds[counter] = fd;
+    }
+}
+
+
+static
+char * append_counters(char * line)
+{
+    unsigned int counter;
+    for(counter = 0; counter < PERF_COUNTER_COUNT; counter += 1)
+    {
+        /* The count, then the time enabled and the time running: */
+        __u64 values[3];
+        int fd = report.perf_fds[counter];
+        if(fd == -1 || read(fd, values, sizeof(values)) != sizeof(values)
+        || !values[2])
+        {
+            continue;
+        }
+        /* Scale up counts which were multiplexed with other counters: */
+        if(values[2] < values[1])
+        {
+            values[0] = (double)values[0] * values[1] / values[2];
+        }
+        line = append_field(line, perf_counters[counter].key, values[0]);
+    }
+    return line;
+}
+#endif
+
+
+/* Writes one line of key=value pairs to the report fd, all in one */
+/* write, so that lines from concurrent reports do not interleave. */
+/* Times are in microseconds, and max_rss in kilobytes on Linux.   */
+static
+void report_usage(int status, char * arg0)
+{
+    char line[1024];
+    char * end = line;
+    struct rusage usage;
+    struct timespec now;
+
+    if(report.fd == -1)
+    {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_CHILDREN, &usage);
+
+    if(WIFSIGNALED(status))
+    {
+        end = append_field(end, "signal=", WTERMSIG(status));
+    }
+    else
+    {
+        end = append_field(end, "exit=", WEXITSTATUS(status));
+    }
+    end = append_field(end, " wall_us=",
+                       (now.tv_sec - report.start.tv_sec) * 1000000UL
+                       + now.tv_nsec / 1000 - report.start.tv_nsec / 1000);
+    end = append_field(end, " user_us=", microseconds(&usage.ru_utime));
+    end = append_field(end, " system_us=", microseconds(&usage.ru_stime));
+    end = append_field(end, " max_rss=", usage.ru_maxrss);
+    end = append_field(end, " minor_faults=", usage.ru_minflt);
+    end = append_field(end, " major_faults=", usage.ru_majflt);
+    end = append_field(end, " voluntary_switches=", usage.ru_nvcsw);
+    end = append_field(end, " involuntary_switches=", usage.ru_nivcsw);
+    end = append_field(end, " inputs=", usage.ru_inblock);
+    end = append_field(end, " outputs=", usage.ru_oublock);
+#ifdef __linux__
+    if(report.perf_stat)
+    {
+        end = append_counters(end);
+    }
+#endif
+    *end++ = '\n';
+
+    /* The command ran either way, so this does not change the status: */
+    if(write(report.fd, line, end - line) != end - line)
+    {
+        error_writing_output(arg0);
+    }
+}
+
+
+static pid_t forwarded_pid;
+/* For --via, where the command is not our child, so its pid could  */
+/* be reused by the time of a signal, a pidfd for it if there is one: */
+static int forwarded_pidfd = -1;
+
+static
+void forward_signal(int signal_number)
+{
+    int errno_ = errno;
+#ifdef SYS_pidfd_send_signal
+    if(forwarded_pidfd != -1)
+    {
+        syscall(SYS_pidfd_send_signal, forwarded_pidfd, signal_number, 0, 0);
+        errno = errno_;
+        return;
+    }
+#endif
+    kill(forwarded_pid, signal_number);
+    errno = errno_;
+}
+
+
+/* Waits for the one child, then exits like it. Like time(1), this   */
+/* stays alive until the child is gone: SIGTERM and SIGHUP, usually  */
+/* sent to this process alone, are passed on to the child, while     */
+/* SIGINT and SIGQUIT, which a terminal sends to the child as well,  */
+/* are ignored. That is only set up now that the child is running,   */
+/* since a child would inherit the ignoring.                         */
+static
+int wait_for_command(pid_t pid, char * arg0)
+{
+    struct sigaction action;
+    int status;
+
+    forwarded_pid = pid;
+    action.sa_handler = forward_signal;
+    action.sa_flags = 0;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, 0);
+    sigaction(SIGHUP, &action, 0);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+
+    while(waitpid(pid, &status, 0) == -1)
+    {
+        if(errno != EINTR)
+        {
+            return error_waiting_for_command(arg0);
+        }
+    }
+    report_usage(status, arg0);
+    return exit_like(status);
+}
+
+
+/* Searches PATH for command, like execvp does, and returns the path */
+/* from malloc, or a null pointer if not found or out of memory.     */
+static
+char * search_path(char const * command)
+{
+    char const * path = getenv("PATH");
+    size_t command_length = strlen(command);
+
+    if(!path)
+    {
+        path = "/bin:/usr/bin";
+    }
+    for(;;)
+    {
+        char const * end = strchr(path, ':');
+        size_t directory_length;
+        char * candidate;
+        struct stat status;
+
+        if(!end)
+        {
+            end = path + strlen(path);
+        }
+        directory_length = end - path;
+        candidate = malloc(directory_length + command_length + 3);
+        if(!candidate)
+        {
+            return 0;
+        }
+
+        /* An empty PATH entry means the current directory: */
+        if(directory_length)
+        {
+            memcpy(candidate, path, directory_length);
+        }
+        else
+        {
+            candidate[0] = '.';
+            directory_length = 1;
+        }
+        candidate[directory_length] = '/';
+        memcpy(candidate + directory_length + 1, command, command_length + 1);
+
+        if(!access(candidate, X_OK)
+        && !stat(candidate, &status) && S_ISREG(status.st_mode))
+        {
+            return candidate;
+        }
+        free(candidate);
+
+        if(!*end)
+        {
+            return 0;
+        }
+        path = end + 1;
+    }
+}
+
+
+/* Like posix_spawnp, or posix_spawn of path if it is not null, but */
+/* with the sh fallback of execvp, which posix_spawnp does not have */
+/* (glibc dropped it in 2.15). Returns 0 or an errno value.          */
+static
+int spawn_file(pid_t * pid, char * path, posix_spawn_file_actions_t * actions,
+               posix_spawnattr_t * attributes, char * * argv)
+{
+    char * found = 0;
+    char * * sh_argv;
+    int error;
+
+    if(path)
+    {
+        error = posix_spawn(pid, path, actions, attributes, argv, environ);
+    }
+    else
+    {
+        error = posix_spawnp(pid, *argv, actions, attributes, argv, environ);
+    }
+    if(error != ENOEXEC)
+    {
+        return error;
+    }
+    if(!path)
+    {
+        path = *argv;
+        if(!strchr(path, '/'))
+        {
+            path = found = search_path(path);
+            if(!found)
+            {
+                return error;
+            }
+        }
+    }
+    sh_argv = new_sh_argv(path, argv);
+    if(sh_argv)
+    {
+        error = posix_spawn(pid, "/bin/sh", actions, attributes, sh_argv,
+                            environ);
+        free(sh_argv);
+    }
+    free(found);
+    return error;
+}
+
+
+static
+int spawn_command(char * * argv, char * arg0)
+{
+    int status;
+    pid_t pid;
+
+    /* The child inherits the mask, which is already set in this process. */
+    /* posix_spawn uses vfork or CLONE_VM|CLONE_VFORK where it can, so    */
+    /* this stays cheap no matter how large this process gets.            */
+    /* It cannot be waited for if SIGCHLD is inherited as ignored:        */
+    signal(SIGCHLD, SIG_DFL);
+    trace_point("spawn", *argv);
+    trace_flush();
+    PROBE1(exec, *argv);
+    status = spawn_file(&pid, 0, 0, 0, argv);
+    if(status)
+    {
+        PROBE2(exec_failed, *argv, status);
+        errno = status;
+        return error_executing_command(*argv, arg0);
+    }
+    return wait_for_command(pid, arg0);
+}
+
+
+#ifdef __linux__
+/* Like spawn_command, but the child waits until the parent has opened */
+/* counters on it, which is when the parent closes the pipe, to exec.  */
+static
+int perf_command(char * * argv, char * arg0)
+{
+    int go[2];
+    pid_t pid;
+
+    if(pipe(go))
+    {
+        return error_executing_command(*argv, arg0);
+    }
+    signal(SIGCHLD, SIG_DFL);
+    pid = fork();
+    if(pid == -1)
+    {
+        return error_executing_command(*argv, arg0);
+    }
+    if(!pid)
+    {
+        char byte;
+        close(go[1]);
+        while(read(go[0], &byte, 1) == -1 && errno == EINTR)
+        {
+        }
+        close(go[0]);
+        _exit(execute_command(argv, arg0));
+    }
+    close(go[0]);
+    open_counters(pid);
+    close(go[1]);
+    return wait_for_command(pid, arg0);
+}
+#endif
+
+
+/* For running as PID 1, such as a container entrypoint: all signals */
+/* are blocked and waited for, so the process sleeps until there is  */
+/* a signal to forward or a child to reap.                           */
+static
+int init_command(char * * argv, char * arg0)
+{
+    posix_spawnattr_t attributes;
+    sigset_t waited_signals;
+    sigset_t old_signals;
+    int status;
+    pid_t pid;
+
+    /* Faults cannot be waited for, and a child cannot be reaped if */
+    /* SIGCHLD is ignored, since its exit status is then discarded: */
+    sigfillset(&waited_signals);
+    sigdelset(&waited_signals, SIGBUS);
+    sigdelset(&waited_signals, SIGFPE);
+    sigdelset(&waited_signals, SIGILL);
+    sigdelset(&waited_signals, SIGSEGV);
+    signal(SIGCHLD, SIG_DFL);
+    sigprocmask(SIG_BLOCK, &waited_signals, &old_signals);
+
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigmask(&attributes, &old_signals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+    trace_point("spawn", *argv);
+    trace_flush();
+    PROBE1(exec, *argv);
+    status = spawn_file(&pid, 0, 0, &attributes, argv);
+    posix_spawnattr_destroy(&attributes);
+    if(status)
+    {
+        PROBE2(exec_failed, *argv, status);
+        errno = status;
+        return error_executing_command(*argv, arg0);
+    }
+
+    for(;;)
+    {
+        int signal_number;
+        pid_t reaped;
+
+        if(sigwait(&waited_signals, &signal_number))
+        {
+            continue;
+        }
+        if(signal_number != SIGCHLD)
+        {
+            kill(pid, signal_number);
+            continue;
+        }
+
+        /* Orphans are reparented to PID 1, so reap every child: */
+        while((reaped = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            if(reaped == pid)
+            {
+                report_usage(status, arg0);
+                /* Or a signal to exit like would stay blocked: */
+                sigprocmask(SIG_SETMASK, &old_signals, 0);
+                return exit_like(status);
+            }
+        }
+        if(reaped == -1 && errno != ECHILD)
+        {
+            return error_waiting_for_command(arg0);
+        }
+    }
+}
+
+
+struct job
+{
+    pid_t pid;
+    unsigned long number;
+};
+
+/* A long-lived process spawning the same commands over and over  */
+/* can search PATH once per command, instead of once per spawn (a  */
+/* failed execve per PATH entry before the right one), like the    */
+/* command hash table of a shell.                                   */
+struct resolved_command
+{
+    struct resolved_command * next;
+    char * path;
+    /* The command name, as given, follows the struct. */
+};
+
+struct job_pool
+{
+    struct job * jobs;
+    /* Null, or a pidfd for each job, to poll for the jobs to finish: */
+    struct pollfd * pidfds;
+    unsigned long size;
+    unsigned long running;
+    /* Null, or how to redirect stdin of each job: */
+    posix_spawn_file_actions_t * actions;
+    /* Where finished --batch jobs are reported: */
+    int status_fd;
+    struct resolved_command * resolved;
+};
+
+
+/* Returns the cached path of command, searching PATH the first time. */
+/* Commands not found, or containing a '/', are left to posix_spawnp. */
+static
+char * resolve_command(struct job_pool * pool, char * command)
+{
+    struct resolved_command * resolved;
+    size_t length;
+
+    if(strchr(command, '/'))
+    {
+        return 0;
+    }
+    for(resolved = pool->resolved; resolved; resolved = resolved->next)
+    {
+        if(!strcmp((char *)(resolved + 1), command))
+        {
+            return resolved->path;
+        }
+    }
+
+    length = strlen(command) + 1;
+    resolved = malloc(sizeof(struct resolved_command) + length);
+    if(!resolved)
+    {
+        return 0;
+    }
+    resolved->path = search_path(command);
+    if(!resolved->path)
+    {
+        free(resolved);
+        return 0;
+    }
+    memcpy(resolved + 1, command, length);
+    resolved->next = pool->resolved;
+    pool->resolved = resolved;
+    return resolved->path;
+}
+
+
+/* Drops the cached path, like "hash -r" for one command, when it no */
+/* longer spawns: the command may have moved, or been removed.       */
+static
+void forget_command(struct job_pool * pool, char * path)
+{
+    struct resolved_command * * link = &pool->resolved;
+    while(*link)
+    {
+        struct resolved_command * resolved = *link;
+        if(resolved->path == path)
+        {
+            *link = resolved->next;
+            free(resolved->path);
+            free(resolved);
+            return;
+        }
+        link = &resolved->next;
+    }
+}
+
+
+/* Jobs must not read the input meant for this process: */
+static
+int open_pool(struct job_pool * pool, unsigned long size, int stdin_is_input,
+              posix_spawn_file_actions_t * actions)
+{
+    /* Jobs cannot be reaped if SIGCHLD is inherited as ignored: */
+    signal(SIGCHLD, SIG_DFL);
+    /* -j takes any number, which must not overflow the size: */
+    pool->jobs = 0;
+    pool->pidfds = 0;
+    if(size <= (size_t)-1 / sizeof(struct job))
+    {
+        pool->jobs = malloc(size * sizeof(struct job));
+    }
+#ifdef SYS_pidfd_open
+    /* Without them, jobs are waited for the old way: */
+    if(size <= (size_t)-1 / sizeof(struct pollfd))
+    {
+        pool->pidfds = malloc(size * sizeof(struct pollfd));
+    }
+#endif
+    pool->size = size;
+    pool->running = 0;
+    pool->actions = 0;
+    pool->status_fd = STDOUT_FILENO;
+    pool->resolved = 0;
+    if(!pool->jobs)
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+    if(stdin_is_input)
+    {
+        int error = posix_spawn_file_actions_init(actions);
+        if(!error)
+        {
+            error = posix_spawn_file_actions_addopen(actions, STDIN_FILENO,
+                                                     "/dev/null", O_RDONLY, 0);
+        }
+        if(error)
+        {
+            errno = error;
+            return 0;
+        }
+        pool->actions = actions;
+    }
+    return 1;
+}
+
+
+static
+void stop_pidfds(struct job_pool * pool)
+{
+    unsigned long index;
+    for(index = 0; index < pool->running; index += 1)
+    {
+        close(pool->pidfds[index].fd);
+    }
+    free(pool->pidfds);
+    pool->pidfds = 0;
+}
+
+
+static
+int start_job(struct job_pool * pool, char * * argv, unsigned long number)
+{
+    struct job * job = pool->jobs + pool->running;
+    char * path = resolve_command(pool, *argv);
+    int error = -1;
+
+    if(path)
+    {
+        error = spawn_file(&job->pid, path, pool->actions, 0, argv);
+        if(error)
+        {
+            forget_command(pool, path);
+        }
+    }
+    /* posix_spawnp searches PATH again, and reports the errors: */
+    if(error)
+    {
+        error = spawn_file(&job->pid, 0, pool->actions, 0, argv);
+    }
+    if(error)
+    {
+        errno = error;
+        return 0;
+    }
+    job->number = number;
+#ifdef SYS_pidfd_open
+    if(pool->pidfds)
+    {
+        /* Always close-on-exec, so later jobs do not inherit it: */
+        int pidfd = syscall(SYS_pidfd_open, job->pid, 0);
+        if(pidfd == -1)
+        {
+            /* Before Linux 5.3, or out of fds: the old way for all: */
+            stop_pidfds(pool);
+        }
+        else
+        {
+            pool->pidfds[pool->running].fd = pidfd;
+            pool->pidfds[pool->running].events = POLLIN;
+        }
+    }
+#endif
+    pool->running += 1;
+    return 1;
+}
+
+
+static
+void remove_job(struct job_pool * pool, unsigned long index,
+                struct job * finished)
+{
+    *finished = pool->jobs[index];
+    pool->running -= 1;
+    pool->jobs[index] = pool->jobs[pool->running];
+    if(pool->pidfds)
+    {
+        close(pool->pidfds[index].fd);
+        pool->pidfds[index] = pool->pidfds[pool->running];
+    }
+}
+
+
+/* Polls the pidfds of the jobs, then waits for just a job which has */
+/* finished, so children inherited from whoever exec'ed us are never */
+/* waited for, and stay for their own parent code to deal with.      */
+static
+int wait_for_job_pidfd(struct job_pool * pool, struct job * finished,
+                       int * status, int options)
+{
+    if(!pool->running)
+    {
+        errno = ECHILD;
+        return 0;
+    }
+    for(;;)
+    {
+        unsigned long index;
+        int ready = poll(pool->pidfds, pool->running,
+                         options & WNOHANG ? 0 : -1);
+        if(ready == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        if(!ready)
+        {
+            return -1;
+        }
+        for(index = 0; index < pool->running; index += 1)
+        {
+            pid_t pid;
+            if(!pool->pidfds[index].revents)
+            {
+                continue;
+            }
+            pid = waitpid(pool->jobs[index].pid, status, WNOHANG);
+            if(pid == -1)
+            {
+                return 0;
+            }
+            if(pid)
+            {
+                remove_job(pool, index, finished);
+                return 1;
+            }
+        }
+    }
+}
+
+
+/* Waits for any job in the pool to finish, and removes it. Returns */
+/* 1 if one finished, 0 on error, and -1 if options has WNOHANG and */
+/* no job has finished yet.                                          */
+static
+int wait_for_job(struct job_pool * pool, struct job * finished, int * status,
+                 int options)
+{
+    if(pool->pidfds)
+    {
+        return wait_for_job_pidfd(pool, finished, status, options);
+    }
+    for(;;)
+    {
+        unsigned long index;
+        pid_t pid = waitpid(-1, status, options);
+        if(pid == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        if(!pid)
+        {
+            return -1;
+        }
+        for(index = 0; index < pool->running; index += 1)
+        {
+            if(pool->jobs[index].pid == pid)
+            {
+                remove_job(pool, index, finished);
+                return 1;
+            }
+        }
+        /* Not a job: a child inherited from whoever exec'ed us. Without */
+        /* pidfds, waiting for any child is the only way to wait for     */
+        /* whichever job finishes first, so its status is lost.          */
+    }
+}
+
+
+/* Records are read and run as they arrive, so a job runner can keep */
+/* one umaskexec open on a pipe: it writes records and reads back    */
+/* status lines, without any exec per job but the job's own.         */
+struct batch
+{
+    int fd;
+    int null_delimited;
+    int end_of_input;
+    /* Bytes before start have been run, bytes before searched hold  */
+    /* no record end, and buffer[used] is always '\0':               */
+    char * buffer;
+    size_t size;
+    size_t used;
+    size_t start;
+    size_t searched;
+    char * * fields;
+    size_t capacity;
+};
+
+
+static
+int add_field(struct batch * batch, size_t count, char * field)
+{
+    if(count == batch->capacity)
+    {
+        size_t capacity = batch->capacity ? batch->capacity * 2 : 16;
+        char * * fields = realloc(batch->fields, capacity * sizeof(char *));
+        if(!fields)
+        {
+            return 0;
+        }
+        batch->fields = fields;
+        batch->capacity = capacity;
+    }
+    batch->fields[count] = field;
+    return 1;
+}
+
+
+/* Returns where the next complete record ends, or a null pointer: */
+static
+char * find_record_end(struct batch * batch)
+{
+    char * start = batch->buffer + batch->start;
+    char * next = batch->buffer + batch->searched;
+    char * end = batch->buffer + batch->used;
+
+    if(!batch->null_delimited)
+    {
+        char * newline = memchr(next, '\n', end - next);
+        batch->searched = newline ? (size_t)(newline - batch->buffer)
+                                  : batch->used;
+        return newline;
+    }
+
+    /* An empty field: a '\0' at the start or right after another: */
+    for(; next < end; next += 1)
+    {
+        if(!*next && (next == start || !next[-1]))
+        {
+            batch->searched = next - batch->buffer;
+            return next;
+        }
+    }
+    batch->searched = batch->used;
+    return 0;
+}
+
+
+/* Reads more of the batch, first making room by dropping the records */
+/* which have been run already, or growing the buffer if there are    */
+/* none to drop.                                                      */
+static
+int read_batch(struct batch * batch)
+{
+    ssize_t bytes;
+
+    if(batch->start)
+    {
+        memmove(batch->buffer, batch->buffer + batch->start,
+                batch->used - batch->start);
+        batch->used -= batch->start;
+        batch->searched -= batch->start;
+        batch->start = 0;
+    }
+    if(batch->used == batch->size - 1)
+    {
+        char * buffer = realloc(batch->buffer, batch->size * 2);
+        if(!buffer)
+        {
+            return 0;
+        }
+        batch->buffer = buffer;
+        batch->size *= 2;
+    }
+
+    do
+    {
+        bytes = read(batch->fd, batch->buffer + batch->used,
+                     batch->size - 1 - batch->used);
+    }
+    while(bytes == -1 && errno == EINTR);
+
+    if(bytes == -1)
+    {
+        return 0;
+    }
+    if(!bytes)
+    {
+        batch->end_of_input = 1;
+    }
+    batch->used += bytes;
+    batch->buffer[batch->used] = '\0';
+    return 1;
+}
+
+
+/* Splits the record ending at end into null-terminated batch->fields, */
+/* and returns the field count (0 for an empty record), or -1 if out   */
+/* of memory.                                                          */
+static
+long split_record(struct batch * batch, char * end)
+{
+    size_t count = 0;
+    char * next = batch->buffer + batch->start;
+
+    if(batch->null_delimited)
+    {
+        /* Each field ends with '\0', and an empty field ends the record: */
+        while(next < end)
+        {
+            if(!add_field(batch, count, next))
+            {
+                return -1;
+            }
+            count += 1;
+            next += strlen(next) + 1;
+        }
+    }
+    else
+    {
+        /* Each line is a record, with fields separated by blanks: */
+        for(;;)
+        {
+            while(next < end && (*next == ' ' || *next == '\t'))
+            {
+                next += 1;
+            }
+            if(next == end)
+            {
+                break;
+            }
+            if(!add_field(batch, count, next))
+            {
+                return -1;
+            }
+            count += 1;
+            while(next < end && *next != ' ' && *next != '\t')
+            {
+                next += 1;
+            }
+            if(next == end)
+            {
+                break;
+            }
+            *next++ = '\0';
+        }
+        *end = '\0';
+    }
+
+    batch->start = end - batch->buffer;
+    if(batch->start < batch->used)
+    {
+        batch->start += 1;
+    }
+    batch->searched = batch->start;
+    return add_field(batch, count, 0) ? (long)count : -1;
+}
+
+
+static
+int write_record_prefix(unsigned long number, char * arg0)
+{
+    char number_string[NUMBER_SIZE];
+    format_number(number, number_string);
+    return write_string(STDERR_FILENO, arg0)
+        && write_string(STDERR_FILENO, ": record ")
+        && write_string(STDERR_FILENO, number_string);
+}
+
+
+/* Writes "<record> exit <status>" or "<record> signal <signal>": */
+static
+int report_job(int fd, struct job * job, int status)
+{
+    char line[NUMBER_SIZE * 2 + sizeof(" signal \n")];
+    char * end = format_number(job->number, line);
+    if(WIFSIGNALED(status))
+    {
+        memcpy(end, " signal ", sizeof(" signal "));
+        end = format_number(WTERMSIG(status), end + sizeof(" signal ") - 1);
+    }
+    else
+    {
+        memcpy(end, " exit ", sizeof(" exit "));
+        end = format_number(WEXITSTATUS(status), end + sizeof(" exit ") - 1);
+    }
+    end[0] = '\n';
+    end[1] = '\0';
+    return write_string(fd, line);
+}
+
+
+/* Waits for and reports one job, or with WNOHANG in options, only  */
+/* one which has already finished. Returns 1 if a job was reported, */
+/* 0 if none, and -1 on error (already reported).                   */
+static
+int report_finished_job(struct job_pool * pool, int options,
+                        int * exit_status, char * arg0)
+{
+    struct job finished;
+    int status;
+    int result = wait_for_job(pool, &finished, &status, options);
+
+    if(result == -1)
+    {
+        return 0;
+    }
+    if(!result)
+    {
+        error_waiting_for_command(arg0);
+        return -1;
+    }
+    if(!report_job(pool->status_fd, &finished, status))
+    {
+        error_writing_output(arg0);
+        return -1;
+    }
+    if(status)
+    {
+        *exit_status = EXIT_FAILURE;
+    }
+    return 1;
+}
+
+
+/* SIGCHLD writes to this pipe, so that finished jobs can be reported */
+/* while waiting for more records, without any polling interval:      */
+static int sigchld_pipe[2] = {-1, -1};
+
+static
+void sigchld_handler(int signal_number)
+{
+    int errno_ = errno;
+    (void)signal_number;
+    if(write(sigchld_pipe[1], "", 1) == -1)
+    {
+        /* Pipe already full, which is just as good. */
+    }
+    errno = errno_;
+}
+
+
+static
+int open_sigchld_pipe(void)
+{
+    struct sigaction action;
+
+    if(pipe(sigchld_pipe)
+    || fcntl(sigchld_pipe[0], F_SETFL, O_NONBLOCK) == -1
+    || fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK) == -1
+    || fcntl(sigchld_pipe[0], F_SETFD, FD_CLOEXEC) == -1
+    || fcntl(sigchld_pipe[1], F_SETFD, FD_CLOEXEC) == -1)
+    {
+        return 0;
+    }
+    action.sa_handler = sigchld_handler;
+    action.sa_flags = SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    return !sigaction(SIGCHLD, &action, 0);
+}
+
+
+/* Sleeps until there is input, reporting jobs which finish meanwhile: */
+static
+int wait_for_input(struct batch * batch, struct job_pool * pool,
+                   int * exit_status, char * file, char * arg0)
+{
+    while(pool->running)
+    {
+        struct pollfd fds[2];
+        char drain[64];
+        int result;
+
+        fds[0].fd = batch->fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = sigchld_pipe[0];
+        fds[1].events = POLLIN;
+        if(poll(fds, 2, -1) == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            error_reading_batch(file, arg0);
+            return 0;
+        }
+        if(fds[1].revents)
+        {
+            while(read(sigchld_pipe[0], drain, sizeof(drain)) > 0);
+            do
+            {
+                result = report_finished_job(pool, WNOHANG, exit_status,
+                                             arg0);
+            }
+            while(result == 1 && pool->running);
+            if(result == -1)
+            {
+                return 0;
+            }
+        }
+        if(fds[0].revents)
+        {
+            break;
+        }
+    }
+    return 1;
+}
+
+
+/* Runs "<mask> <command> [<argument>]..." records from file, up to   */
+/* job_count at a time. Every job is spawned by this one process, so */
+/* there is no shell or umaskexec exec per job. The child inherits   */
+/* the mask, so it is set here right before each spawn, and only if  */
+/* it differs from the previous job's.                               */
+static
+int run_batch(char * file, int null_delimited, unsigned long job_count,
+              int status_fd, char * arg0)
+{
+    struct batch batch;
+    struct job_pool pool;
+    posix_spawn_file_actions_t actions;
+    unsigned long number = 0;
+    int exit_status = EXIT_SUCCESS;
+    mode_t base_mask = umask(0);
+    mode_t current_mask = 0;
+
+    batch.fd = STDIN_FILENO;
+    if(strcmp(file, "-"))
+    {
+        batch.fd = open(file, O_RDONLY);
+        if(batch.fd == -1)
+        {
+            return error_reading_batch(file, arg0);
+        }
+    }
+    batch.null_delimited = null_delimited;
+    batch.end_of_input = 0;
+    batch.size = 65536;
+    batch.buffer = malloc(batch.size);
+    batch.used = 0;
+    batch.start = 0;
+    batch.searched = 0;
+    batch.fields = 0;
+    batch.capacity = 0;
+
+    if(!batch.buffer
+    || !open_pool(&pool, job_count, batch.fd == STDIN_FILENO, &actions)
+    || !open_sigchld_pipe())
+    {
+        return error_reading_batch(file, arg0);
+    }
+    batch.buffer[0] = '\0';
+
+    /* Jobs must not be able to write to it, or hold it open: */
+    if(status_fd != -1)
+    {
+        if(fcntl(status_fd, F_SETFD, FD_CLOEXEC) == -1)
+        {
+            return error_writing_output(arg0);
+        }
+        pool.status_fd = status_fd;
+    }
+
+    for(;;)
+    {
+        char * end = find_record_end(&batch);
+        long field_count;
+        mode_t mask = base_mask;
+
+        if(!end)
+        {
+            if(!batch.end_of_input)
+            {
+                if(!wait_for_input(&batch, &pool, &exit_status, file, arg0))
+                {
+                    return EXIT_FAILURE;
+                }
+                if(!read_batch(&batch))
+                {
+                    return error_reading_batch(file, arg0);
+                }
+                continue;
+            }
+            /* The last record need not be terminated: */
+            if(batch.start == batch.used)
+            {
+                break;
+            }
+            end = batch.buffer + batch.used;
+        }
+
+        field_count = split_record(&batch, end);
+        if(field_count == -1)
+        {
+            return error_reading_batch(file, arg0);
+        }
+        number += 1;
+        if(!field_count)
+        {
+            continue;
+        }
+        if(field_count == 1)
+        {
+            if(write_record_prefix(number, arg0))
+            {
+                write_string(STDERR_FILENO, ": missing command\n");
+            }
+            exit_status = EXIT_FAILURE;
+            continue;
+        }
+        if(umaskexec_parse_mask(batch.fields[0], &mask))
+        {
+            if(write_record_prefix(number, arg0)
+            && write_string(STDERR_FILENO, ": bad mask: ")
+            && write_string(STDERR_FILENO, batch.fields[0]))
+            {
+                write_string(STDERR_FILENO, "\n");
+            }
+            exit_status = EXIT_FAILURE;
+            continue;
+        }
+
+        if(pool.running == pool.size
+        && report_finished_job(&pool, 0, &exit_status, arg0) == -1)
+        {
+            return EXIT_FAILURE;
+        }
+
+        if(mask != current_mask)
+        {
+            umask(mask);
+            current_mask = mask;
+        }
+        if(!start_job(&pool, batch.fields + 1, number))
+        {
+            int errno_ = errno;
+            if(write_record_prefix(number, arg0)
+            && write_string(STDERR_FILENO, ": error executing command: "))
+            {
+                errno = errno_;
+                write_perror(batch.fields[1]);
+            }
+            exit_status = EXIT_FAILURE;
+        }
+    }
+
+    while(pool.running)
+    {
+        if(report_finished_job(&pool, 0, &exit_status, arg0) == -1)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return exit_status;
+}
+
+
+/* Exit statuses as documented for xargs: */
+#define ARGS0_COMMAND_FAILED 123
+#define ARGS0_COMMAND_EXITED_255 124
+#define ARGS0_COMMAND_KILLED 125
+#define ARGS0_COMMAND_NOT_RUN 126
+#define ARGS0_COMMAND_NOT_FOUND 127
+
+
+/* Returns 0 to keep going, or the exit status to stop with: */
+static
+int args0_stop_status(int status, int * exit_status)
+{
+    if(WIFSIGNALED(status))
+    {
+        return ARGS0_COMMAND_KILLED;
+    }
+    status = WEXITSTATUS(status);
+    if(status == 255)
+    {
+        return ARGS0_COMMAND_EXITED_255;
+    }
+    if(status)
+    {
+        *exit_status = ARGS0_COMMAND_FAILED;
+    }
+    return 0;
+}
+
+
+struct args0
+{
+    /* The arguments given, then those read, then a null pointer: */
+    char * * argv;
+    size_t fixed_count;
+    size_t count;
+    size_t capacity;
+    /* Bytes the arguments read from stdin take up in the exec: */
+    size_t size;
+};
+
+
+static
+int add_argument(struct args0 * args, char * argument)
+{
+    if(args->count + 1 == args->capacity)
+    {
+        size_t capacity = args->capacity * 2;
+        char * * argv = realloc(args->argv, capacity * sizeof(char *));
+        if(!argv)
+        {
+            return 0;
+        }
+        args->argv = argv;
+        args->capacity = capacity;
+    }
+    args->argv[args->count] = argument;
+    args->count += 1;
+    args->size += strlen(argument) + 1 + sizeof(char *);
+    return 1;
+}
+
+
+/* How many bytes of arguments read from stdin fit in one exec: */
+static
+size_t args0_limit(char * * argv)
+{
+    long arg_max = sysconf(_SC_ARG_MAX);
+    size_t used = 2048;
+    size_t limit;
+    char * * string;
+
+    if(arg_max == -1)
+    {
+        arg_max = 4096;
+    }
+    /* The environment and given arguments share the same space: */
+    for(string = environ; *string; string += 1)
+    {
+        used += strlen(*string) + 1 + sizeof(char *);
+    }
+    for(string = argv; *string; string += 1)
+    {
+        used += strlen(*string) + 1 + sizeof(char *);
+    }
+    limit = (size_t)arg_max > used ? (size_t)arg_max - used : 0;
+
+    /* Keep the buffer modest on systems with a huge ARG_MAX: */
+    if(limit > 1 << 20)
+    {
+        limit = 1 << 20;
+    }
+    return limit;
+}
+
+
+static
+int error_argument_too_long(char * arg0)
+{
+    if(write_string(STDERR_FILENO, arg0))
+    {
+        write_string(STDERR_FILENO, ": argument too long\n");
+    }
+    return EXIT_FAILURE;
+}
+
+
+static
+int error_reading_input(char * arg0)
+{
+    int errno_ = errno;
+    if(write_string(STDERR_FILENO, arg0))
+    {
+        errno = errno_;
+        write_perror(": error reading input");
+    }
+    return EXIT_FAILURE;
+}
+
+
+/* Spawns args as one job, waiting for a free slot first. Returns 0  */
+/* to keep going, or the exit status to stop with.                   */
+static
+int start_args0_job(struct job_pool * pool, struct args0 * args,
+                    int * exit_status, char * arg0)
+{
+    struct job finished;
+    int status;
+
+    if(pool->running == pool->size)
+    {
+        if(!wait_for_job(pool, &finished, &status, 0))
+        {
+            error_waiting_for_command(arg0);
+            return EXIT_FAILURE;
+        }
+        status = args0_stop_status(status, exit_status);
+        if(status)
+        {
+            return status;
+        }
+    }
+
+    args->argv[args->count] = 0;
+    if(!start_job(pool, args->argv, 0))
+    {
+        int errno_ = errno;
+        error_executing_command(*args->argv, arg0);
+        return errno_ == ENOENT ? ARGS0_COMMAND_NOT_FOUND
+                                : ARGS0_COMMAND_NOT_RUN;
+    }
+    args->count = args->fixed_count;
+    args->size = 0;
+    return 0;
+}
+
+
+/* Like xargs -0: runs the command with as many null-terminated     */
+/* arguments from stdin appended as fit in one exec, up to          */
+/* job_count at a time. The mask is set once, and inherited by all. */
+static
+int run_args0(char * * argv, unsigned long job_count, char * arg0)
+{
+    struct args0 args;
+    struct job_pool pool;
+    posix_spawn_file_actions_t actions;
+    struct job finished;
+    size_t limit = args0_limit(argv);
+    char * buffer = malloc(limit + 1);
+    size_t used = 0;
+    size_t scanned = 0;
+    size_t batch_start = 0;
+    int exit_status = EXIT_SUCCESS;
+    int stop_status = 0;
+    int status;
+    int end_of_input = 0;
+    int spawned = 0;
+
+    args.fixed_count = 0;
+    while(argv[args.fixed_count])
+    {
+        args.fixed_count += 1;
+    }
+    args.count = args.fixed_count;
+    args.capacity = args.fixed_count + 64;
+    args.size = 0;
+    args.argv = malloc(args.capacity * sizeof(char *));
+
+    if(!buffer || !args.argv
+    || !open_pool(&pool, job_count, 1, &actions))
+    {
+        return error_reading_input(arg0);
+    }
+    memcpy(args.argv, argv, args.fixed_count * sizeof(char *));
+
+    while(!stop_status)
+    {
+        char * argument = buffer + scanned;
+        char * terminator = memchr(argument, '\0', used - scanned);
+
+        if(!terminator && end_of_input)
+        {
+            if(scanned == used)
+            {
+                break;
+            }
+            /* The last argument need not be null-terminated: */
+            buffer[used] = '\0';
+            terminator = buffer + used;
+            used += 1;
+        }
+
+        if(terminator)
+        {
+            size_t size = terminator - argument + 1 + sizeof(char *);
+            if(size > limit)
+            {
+                stop_status = error_argument_too_long(arg0);
+                break;
+            }
+            if(args.size + size > limit)
+            {
+                stop_status = start_args0_job(&pool, &args, &exit_status,
+                                              arg0);
+                spawned = 1;
+                batch_start = scanned;
+            }
+            else
+            if(!add_argument(&args, argument))
+            {
+                stop_status = error_reading_input(arg0);
+                break;
+            }
+            else
+            {
+                scanned = terminator + 1 - buffer;
+            }
+            continue;
+        }
+
+        /* Out of buffer: the previous batches have been exec'ed, so */
+        /* their arguments can be dropped to make room for more.     */
+        if(used == limit && batch_start)
+        {
+            size_t index;
+            memmove(buffer, buffer + batch_start, used - batch_start);
+            for(index = args.fixed_count; index < args.count; index += 1)
+            {
+                args.argv[index] -= batch_start;
+            }
+            used -= batch_start;
+            scanned -= batch_start;
+            batch_start = 0;
+        }
+        if(used == limit)
+        {
+            if(args.count == args.fixed_count)
+            {
+                stop_status = error_argument_too_long(arg0);
+                break;
+            }
+            stop_status = start_args0_job(&pool, &args, &exit_status, arg0);
+            spawned = 1;
+            batch_start = scanned;
+            continue;
+        }
+
+        {
+            ssize_t bytes = read(STDIN_FILENO, buffer + used, limit - used);
+            if(bytes == -1)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                stop_status = error_reading_input(arg0);
+                break;
+            }
+            if(!bytes)
+            {
+                end_of_input = 1;
+            }
+            used += bytes;
+        }
+    }
+
+    /* Like xargs, run the command once even with no input: */
+    if(!stop_status && (args.count > args.fixed_count || !spawned))
+    {
+        stop_status = start_args0_job(&pool, &args, &exit_status, arg0);
+    }
+
+    /* Errors only stop reading: like xargs, jobs already running are */
+    /* still waited for, so none outlives this process unnoticed.    */
+    while(pool.running)
+    {
+        if(!wait_for_job(&pool, &finished, &status, 0))
+        {
+            return error_waiting_for_command(arg0);
+        }
+        status = args0_stop_status(status, &exit_status);
+        if(status && !stop_status)
+        {
+            stop_status = status;
+        }
+    }
+    return stop_status ? stop_status : exit_status;
+}
+
+
+/* The spawn server (umaskexecd): zygotes are children forked ahead of */
+/* time, with the mask and the rest of the setup already applied, each */
+/* waiting to accept one connection and to exec one command for it, so */
+/* that a launch costs the exec, and nothing else. A client sends       */
+/*                                                                      */
+/*     <mask>\0<argument count>\0<argument>\0...<name>=<value>\0...     */
+/*                                                                      */
+/* with its stdin, stdout, stderr and working directory attached as     */
+/* SCM_RIGHTS fds, then shuts down its sending side. The zygote replies */
+/* "<pid>\n", with a pidfd for itself attached where there are pidfds,  */
+/* and execs the command. Once that exits, the server, whose child it   */
+/* is, replies "<pid> exit <status>\n" or "<pid> signal <signal>\n".    */
+#define REQUEST_FDS 4
+
+/* Sends data with fds attached, which arrive with its first byte: */
+static
+ssize_t send_fds(int socket_fd, char * data, size_t size, int * fds,
+                 int fd_count)
+{
+    union
+    {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+    }
+    control;
+    struct msghdr message;
+    struct iovec part;
+
+    part.iov_base = data;
+    part.iov_len = size;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    if(fd_count)
+    {
+        struct cmsghdr * header;
+        memset(&control, 0, sizeof(control));
+        message.msg_control = control.space;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(header), fds, sizeof(int) * fd_count);
+    }
+    /* A client which has gone away is an error, not a SIGPIPE: */
+    return sendmsg(socket_fd, &message, MSG_NOSIGNAL);
+}
+
+
+/* Receives data, and up to *fd_count fds attached to it, setting  */
+/* *fd_count to how many there were. Any more than that are closed. */
+static
+ssize_t receive_fds(int socket_fd, char * buffer, size_t size, int * fds,
+                    int * fd_count)
+{
+    union
+    {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+    }
+    control;
+    struct msghdr message;
+    struct iovec part;
+    struct cmsghdr * header;
+    int wanted = *fd_count;
+    ssize_t received;
+
+    part.iov_base = buffer;
+    part.iov_len = size;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    *fd_count = 0;
+    received = recvmsg(socket_fd, &message, 0);
+    if(received == -1)
+    {
+        return -1;
+    }
+    for(header = CMSG_FIRSTHDR(&message); header;
+        header = CMSG_NXTHDR(&message, header))
+    {
+        size_t index;
+        if(header->cmsg_level != SOL_SOCKET
+        || header->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+        for(index = 0; CMSG_LEN((index + 1) * sizeof(int))
+                       <= header->cmsg_len; index += 1)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(header) + index * sizeof(int), sizeof(int));
+            if(*fd_count < wanted)
+            {
+                fds[*fd_count] = fd;
+                *fd_count += 1;
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+    }
+    return received;
+}
+
+
+/* Reads a request to its end, sets this process up the way it asks */
+/* and replies with the pid, then execs the command. Returns only   */
+/* on errors, which are reported on the client's stderr if it has   */
+/* been received by then.                                            */
+static
+int serve_request(int connection, mode_t mask, char * arg0)
+{
+    int fds[REQUEST_FDS];
+    int fd_count = REQUEST_FDS;
+    size_t size = 4096;
+    size_t used = 0;
+    size_t count = 0;
+    char * buffer = malloc(size);
+    char * * strings;
+    char * string;
+    unsigned long argument_count;
+    mode_t request_mask;
+    ssize_t received = -1;
+    char line[NUMBER_SIZE + 1];
+    char * end;
+    int pidfd = -1;
+    int fd;
+
+    if(buffer)
+    {
+        received = receive_fds(connection, buffer, size - 1, fds, &fd_count);
+    }
+    while(received > 0)
+    {
+        used += received;
+        if(used == size - 1)
+        {
+            char * bigger = realloc(buffer, size * 2);
+            if(!bigger)
+            {
+                received = -1;
+                break;
+            }
+            buffer = bigger;
+            size *= 2;
+        }
+        received = read(connection, buffer + used, size - 1 - used);
+    }
+    if(received == -1)
+    {
+        return error_reading_input(arg0);
+    }
+
+    /* Received fds are never 0, 1 or 2, which the server keeps open: */
+    if(fd_count != REQUEST_FDS)
+    {
+        errno = EPROTO;
+        return error_reading_input(arg0);
+    }
+    for(fd = 0; fd < 3; fd += 1)
+    {
+        if(dup2(fds[fd], fd) == -1)
+        {
+            return error_reading_input(arg0);
+        }
+        close(fds[fd]);
+    }
+    if(fchdir(fds[3]))
+    {
+        error_setting("directory", arg0);
+        return EXIT_FAILURE;
+    }
+    close(fds[3]);
+
+    /* Every string, the last included, must end with a '\0': */
+    for(string = buffer; string < buffer + used; string += 1)
+    {
+        if(!*string)
+        {
+            count += 1;
+        }
+    }
+    strings = malloc((count + 1) * sizeof(char *));
+    if(!strings)
+    {
+        return error_reading_input(arg0);
+    }
+    buffer[used] = '\0';
+    if(!used || buffer[used - 1] || count < 3
+    || umaskexec_parse_mask_octal(buffer, &request_mask)
+    || !parse_number(buffer + strlen(buffer) + 1, 1, count - 2,
+                     &argument_count))
+    {
+        errno = EPROTO;
+        return error_reading_input(arg0);
+    }
+
+    /* The arguments, a null pointer, then the environment, which */
+    /* takes the place of the mask and argument count strings:    */
+    string = buffer + strlen(buffer) + 1;
+    string += strlen(string) + 1;
+    for(count = 0; string < buffer + used; count += 1)
+    {
+        if(count == argument_count)
+        {
+            strings[count] = 0;
+            count += 1;
+        }
+        strings[count] = string;
+        string += strlen(string) + 1;
+    }
+    if(count == argument_count)
+    {
+        strings[count] = 0;
+        count += 1;
+    }
+    strings[count] = 0;
+    environ = strings + argument_count + 1;
+
+    if(request_mask != mask)
+    {
+        umask(request_mask);
+        PROBE2(mask, mask, request_mask);
+    }
+
+    end = format_number(getpid(), line);
+    *end++ = '\n';
+#ifdef SYS_pidfd_open
+    pidfd = syscall(SYS_pidfd_open, getpid(), 0);
+#endif
+    if(send_fds(connection, line, end - line, &pidfd, pidfd != -1)
+       != end - line)
+    {
+        return error_reading_input(arg0);
+    }
+    if(pidfd != -1)
+    {
+        close(pidfd);
+    }
+    return execute_command(strings, arg0);
+}
+
+
+/* A zygote, or once it has taken a connection, the job it became: */
+struct zygote
+{
+    pid_t pid;
+    /* The server's end of the socket pair the zygote hands over its */
+    /* connection on, or -1 once it has, or has been told to stop:   */
+    int fd;
+    /* The connection once the zygote has taken one, or -1: */
+    int connection;
+};
+
+struct server
+{
+    char * path;
+    int listen_fd;
+    mode_t mask;
+    struct zygote * zygotes;
+    /* One more than the zygotes, for the signal pipe: */
+    struct pollfd * fds;
+    unsigned long count;
+    unsigned long capacity;
+    int stopping;
+    int exit_status;
+};
+
+
+/* Waits for a connection and hands it to the server, which reports */
+/* the status of this process, then serves it. Never returns.       */
+static
+void run_zygote(struct server * server, int server_fd, char * arg0)
+{
+    struct pollfd fds[2];
+    unsigned long index;
+    int connection;
+
+    /* Nothing inherited from the server must outlive it in here: */
+    for(index = 0; index < server->count; index += 1)
+    {
+        if(server->zygotes[index].fd != -1)
+        {
+            close(server->zygotes[index].fd);
+        }
+        if(server->zygotes[index].connection != -1)
+        {
+            close(server->zygotes[index].connection);
+        }
+    }
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    fds[0].fd = server->listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = server_fd;
+    fds[1].events = POLLIN;
+    for(;;)
+    {
+        if(poll(fds, 2, -1) == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            _exit(error_serving(server->path, arg0));
+        }
+        /* The server only closes its end, to stop this zygote: */
+        if(fds[1].revents)
+        {
+            _exit(EXIT_SUCCESS);
+        }
+        connection = accept(server->listen_fd, 0, 0);
+        if(connection != -1)
+        {
+            break;
+        }
+        /* Another zygote got there first, or the client gave up: */
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR
+        && errno != ECONNABORTED)
+        {
+            _exit(error_serving(server->path, arg0));
+        }
+    }
+
+    /* On BSDs, it is non-blocking like the listening socket: */
+    if(fcntl(connection, F_SETFD, FD_CLOEXEC) == -1
+    || fcntl(connection, F_SETFL, 0) == -1
+    || send_fds(server_fd, "", 1, &connection, 1) != 1)
+    {
+        _exit(error_serving(server->path, arg0));
+    }
+    close(server_fd);
+    _exit(serve_request(connection, server->mask, arg0));
+}
+
+
+static
+int fork_zygote(struct server * server, char * arg0)
+{
+    struct zygote * zygote;
+    int pair[2];
+    pid_t pid;
+
+    if(server->count == server->capacity)
+    {
+        unsigned long capacity = server->capacity * 2 + 4;
+        struct pollfd * fds;
+        zygote = realloc(server->zygotes, capacity * sizeof(struct zygote));
+        if(!zygote)
+        {
+            return 0;
+        }
+        server->zygotes = zygote;
+        fds = realloc(server->fds, (capacity + 1) * sizeof(struct pollfd));
+        if(!fds)
+        {
+            return 0;
+        }
+        server->fds = fds;
+        server->capacity = capacity;
+    }
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair))
+    {
+        return 0;
+    }
+    if(fcntl(pair[0], F_SETFD, FD_CLOEXEC) == -1
+    || fcntl(pair[0], F_SETFL, O_NONBLOCK) == -1
+    || fcntl(pair[1], F_SETFD, FD_CLOEXEC) == -1
+    || (pid = fork()) == -1)
+    {
+        int errno_ = errno;
+        close(pair[0]);
+        close(pair[1]);
+        errno = errno_;
+        return 0;
+    }
+    if(!pid)
+    {
+        close(pair[0]);
+        run_zygote(server, pair[1], arg0);
+    }
+    close(pair[1]);
+
+    zygote = server->zygotes + server->count;
+    zygote->pid = pid;
+    zygote->fd = pair[0];
+    zygote->connection = -1;
+    server->count += 1;
+    return 1;
+}
+
+
+/* Takes the connection a zygote has accepted, if it has sent it yet, */
+/* and forks another zygote to take its place. Returns 0 on errors.  */
+static
+int take_connection(struct server * server, unsigned long index,
+                    char * arg0)
+{
+    struct zygote * zygote = server->zygotes + index;
+    char byte;
+    int connection;
+    int fd_count = 1;
+    ssize_t received = receive_fds(zygote->fd, &byte, 1, &connection,
+                                   &fd_count);
+
+    if(received == -1)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    close(zygote->fd);
+    zygote->fd = -1;
+    /* Without one, it exited first, which reaping it reports: */
+    if(!fd_count)
+    {
+        return 1;
+    }
+    /* Before any fork, so that no other job inherits it: */
+    if(fcntl(connection, F_SETFD, FD_CLOEXEC) == -1)
+    {
+        close(connection);
+        return 0;
+    }
+    zygote->connection = connection;
+    return server->stopping || fork_zygote(server, arg0);
+}
+
+
+/* Stops taking connections: idle zygotes exit, and the server exits */
+/* too, once the jobs already running have been reported.            */
+static
+void stop_serving(struct server * server, char * arg0)
+{
+    unsigned long index;
+
+    server->stopping = 1;
+    unlink(server->path);
+    close(server->listen_fd);
+    for(index = 0; index < server->count; index += 1)
+    {
+        struct zygote * zygote = server->zygotes + index;
+        if(zygote->fd == -1)
+        {
+            continue;
+        }
+        /* A connection it has already handed over is still served: */
+        take_connection(server, index, arg0);
+        if(zygote->fd != -1)
+        {
+            close(zygote->fd);
+            zygote->fd = -1;
+        }
+    }
+}
+
+
+static
+int reap_zygotes(struct server * server, char * arg0)
+{
+    pid_t pid;
+    int status;
+
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        unsigned long index;
+        struct zygote * zygote;
+
+        for(index = 0; index < server->count; index += 1)
+        {
+            if(server->zygotes[index].pid == pid)
+            {
+                break;
+            }
+        }
+        if(index == server->count)
+        {
+            continue;
+        }
+        /* It may have handed over a connection just before exiting: */
+        if(server->zygotes[index].fd != -1
+        && !take_connection(server, index, arg0))
+        {
+            return 0;
+        }
+        zygote = server->zygotes + index;
+        if(zygote->connection != -1)
+        {
+            struct job job;
+            job.pid = pid;
+            job.number = pid;
+            /* A client which has gone away is no reason to stop: */
+            report_job(zygote->connection, &job, status);
+            close(zygote->connection);
+        }
+        else
+        if(!server->stopping)
+        {
+            /* Zygotes only exit early on errors, which they report: */
+            server->exit_status = EXIT_FAILURE;
+            stop_serving(server, arg0);
+        }
+        if(zygote->fd != -1)
+        {
+            close(zygote->fd);
+        }
+        server->count -= 1;
+        *zygote = server->zygotes[server->count];
+    }
+    return 1;
+}
+
+
+/* SIGTERM, SIGINT and SIGHUP stop the server through the signal pipe: */
+static volatile sig_atomic_t stop_requested;
+
+static
+void stop_handler(int signal_number)
+{
+    stop_requested = 1;
+    sigchld_handler(signal_number);
+}
+
+
+/* Serves --via clients on the unix socket at path, keeping         */
+/* zygote_count zygotes ready. The socket is created with the mask  */
+/* applied, like any file, so the mask also limits who can connect. */
+static
+int run_server(char * path, unsigned long zygote_count, char * arg0)
+{
+    struct server server;
+    struct sockaddr_un address;
+    struct sigaction action;
+    unsigned long index;
+    int fd;
+
+    /* Fds received by zygotes must not take the place of these: */
+    for(fd = 0; fd < 3; fd += 1)
+    {
+        if(fcntl(fd, F_GETFD) == -1 && open("/dev/null", O_RDWR) != fd)
+        {
+            return error_serving(path, arg0);
+        }
+    }
+
+    if(strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return error_serving(path, arg0);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    server.path = path;
+    server.mask = umask(0);
+    umask(server.mask);
+    server.zygotes = 0;
+    server.fds = 0;
+    server.count = 0;
+    server.capacity = 0;
+    server.stopping = 0;
+    server.exit_status = EXIT_SUCCESS;
+
+    /* Non-blocking, since every idle zygote is woken for a client: */
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server.listen_fd == -1
+    || fcntl(server.listen_fd, F_SETFD, FD_CLOEXEC) == -1
+    || fcntl(server.listen_fd, F_SETFL, O_NONBLOCK) == -1
+    || bind(server.listen_fd, (struct sockaddr *)&address, sizeof(address)))
+    {
+        return error_serving(path, arg0);
+    }
+    if(listen(server.listen_fd, SOMAXCONN) || !open_sigchld_pipe())
+    {
+        error_serving(path, arg0);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+    action.sa_handler = stop_handler;
+    action.sa_flags = 0;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, 0);
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGTERM, &action, 0);
+    /* Statuses are written to clients which may have gone away: */
+    signal(SIGPIPE, SIG_IGN);
+
+    for(index = 0; index < zygote_count; index += 1)
+    {
+        if(!fork_zygote(&server, arg0))
+        {
+            server.exit_status = error_serving(path, arg0);
+            stop_serving(&server, arg0);
+            break;
+        }
+    }
+
+    while(server.count)
+    {
+        unsigned long polled = 1;
+        unsigned long count = server.count;
+        char drain[64];
+
+        if(stop_requested && !server.stopping)
+        {
+            stop_serving(&server, arg0);
+        }
+        server.fds[0].fd = sigchld_pipe[0];
+        server.fds[0].events = POLLIN;
+        for(index = 0; index < count; index += 1)
+        {
+            if(server.zygotes[index].fd != -1)
+            {
+                server.fds[polled].fd = server.zygotes[index].fd;
+                server.fds[polled].events = POLLIN;
+                polled += 1;
+            }
+        }
+        if(poll(server.fds, polled, -1) == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            server.exit_status = error_serving(path, arg0);
+            stop_serving(&server, arg0);
+            return EXIT_FAILURE;
+        }
+
+        /* The zygotes forked meanwhile are after count, and not polled: */
+        for(index = 0, polled = 1; index < count; index += 1)
+        {
+            if(server.zygotes[index].fd == -1)
+            {
+                continue;
+            }
+            if(server.fds[polled++].revents
+            && !take_connection(&server, index, arg0))
+            {
+                server.exit_status = error_serving(path, arg0);
+                stop_serving(&server, arg0);
+            }
+        }
+        if(server.fds[0].revents)
+        {
+            while(read(sigchld_pipe[0], drain, sizeof(drain)) > 0);
+            if(!reap_zygotes(&server, arg0))
+            {
+                server.exit_status = error_serving(path, arg0);
+                stop_serving(&server, arg0);
+            }
+        }
+    }
+    return server.exit_status;
+}
+
+
+/* Has the server at path run the command with this process's stdio, */
+/* working directory, environment and mask, then exits like it. Like */
+/* --spawn, signals are passed on meanwhile, but SIGINT and SIGQUIT  */
+/* too, since the command is not in this process's process group.    */
+static
+int run_via(char * path, char * * argv, char * arg0)
+{
+    struct sockaddr_un address;
+    struct sigaction action;
+    char count_string[NUMBER_SIZE];
+    char mask_string[UMASKEXEC_OCTAL_SIZE];
+    char reply[NUMBER_SIZE * 3 + sizeof(" signal \n")];
+    size_t reply_used = 0;
+    size_t size;
+    size_t sent;
+    char * request;
+    char * end;
+    char * * string;
+    mode_t mask = umask(0);
+    int fds[REQUEST_FDS];
+    int connection;
+
+    umask(mask);
+    umaskexec_format_mask_octal(mask, mask_string);
+    for(string = argv; *string; string += 1)
+    {
+    }
+    format_number(string - argv, count_string);
+
+    size = strlen(mask_string) + strlen(count_string) + 2;
+    for(string = argv; *string; string += 1)
+    {
+        size += strlen(*string) + 1;
+    }
+    for(string = environ; *string; string += 1)
+    {
+        size += strlen(*string) + 1;
+    }
+    request = malloc(size);
+    if(!request)
+    {
+        return error_reaching_server(path, arg0);
+    }
+    end = copy_string(request, mask_string);
+    *end++ = '\0';
+    end = copy_string(end, count_string);
+    *end++ = '\0';
+    for(string = argv; *string; string += 1)
+    {
+        end = copy_string(end, *string);
+        *end++ = '\0';
+    }
+    for(string = environ; *string; string += 1)
+    {
+        end = copy_string(end, *string);
+        *end++ = '\0';
+    }
+
+    if(strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return error_reaching_server(path, arg0);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    fds[0] = STDIN_FILENO;
+    fds[1] = STDOUT_FILENO;
+    fds[2] = STDERR_FILENO;
+    fds[3] = open(".", EXEC_OPEN_FLAGS | O_DIRECTORY | O_CLOEXEC);
+    connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fds[3] == -1 || connection == -1
+    || connect(connection, (struct sockaddr *)&address, sizeof(address)))
+    {
+        return error_reaching_server(path, arg0);
+    }
+    trace_point("via", *argv);
+    trace_flush();
+    PROBE1(exec, *argv);
+    sent = 0;
+    while(sent < size)
+    {
+        ssize_t result = sent ? send(connection, request + sent, size - sent,
+                                     MSG_NOSIGNAL)
+                              : send_fds(connection, request, size, fds,
+                                         REQUEST_FDS);
+        if(result == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return error_reaching_server(path, arg0);
+        }
+        sent += result;
+    }
+    shutdown(connection, SHUT_WR);
+    close(fds[3]);
+    free(request);
+
+    /* "<pid>\n" once it is running, "<pid> <how> <number>\n" once not: */
+    for(;;)
+    {
+        char * newline = memchr(reply, '\n', reply_used);
+        int pidfd = -1;
+        int fd_count = forwarded_pidfd == -1;
+        unsigned long pid;
+        unsigned long number;
+        ssize_t received;
+        char const * field;
+
+        if(newline)
+        {
+            *newline = '\0';
+            field = parse_digits(reply, (unsigned long)-1, &pid);
+            if(field && !*field)
+            {
+                forwarded_pid = pid;
+                action.sa_handler = forward_signal;
+                action.sa_flags = 0;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGHUP, &action, 0);
+                sigaction(SIGINT, &action, 0);
+                sigaction(SIGQUIT, &action, 0);
+                sigaction(SIGTERM, &action, 0);
+            }
+            else
+            if(field && !strncmp(field, " exit ", 6)
+            && parse_number(field + 6, 0, 255, &number))
+            {
+                return number;
+            }
+            else
+            if(field && !strncmp(field, " signal ", 8)
+            && parse_number(field + 8, 1, INT_MAX, &number))
+            {
+                return exit_like_signal(number);
+            }
+            else
+            {
+                errno = EPROTO;
+                return error_waiting_for_command(arg0);
+            }
+            reply_used -= newline + 1 - reply;
+            memmove(reply, newline + 1, reply_used);
+            continue;
+        }
+        if(reply_used == sizeof(reply))
+        {
+            errno = EPROTO;
+            return error_waiting_for_command(arg0);
+        }
+        received = receive_fds(connection, reply + reply_used,
+                               sizeof(reply) - reply_used, &pidfd,
+                               &fd_count);
+        if(received == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if(received <= 0)
+        {
+            /* The server is gone, or it never got the command going: */
+            if(!received)
+            {
+                errno = ECONNRESET;
+            }
+            return error_waiting_for_command(arg0);
+        }
+        if(fd_count)
+        {
+            forwarded_pidfd = pidfd;
+        }
+        reply_used += received;
+    }
+}
+
+
+static
+void error_bad_mask_line(unsigned long line, char * mask_string, char * arg0)
+{
+    char number_string[NUMBER_SIZE];
+    format_number(line, number_string);
+    if(write_string(STDERR_FILENO, arg0)
+    && write_string(STDERR_FILENO, ": line ")
+    && write_string(STDERR_FILENO, number_string)
+    && write_string(STDERR_FILENO, ": bad mask: ")
+    && write_string(STDERR_FILENO, mask_string))
+    {
+        write_string(STDERR_FILENO, "\n");
+    }
+}
+
+
+static
+int write_all(int fd, char const * buffer, size_t size)
+{
+    while(size)
+    {
+        ssize_t written = write(fd, buffer, size);
+        if(written == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        buffer += written;
+        size -= written;
+    }
+    return 1;
+}
+
+
+#define MASKS_BUFFER_SIZE 65536
+
+/* Checks, or converts to canonical form, masks read from stdin, one  */
+/* per line (or per null), relative to base, without ever setting the */
+/* process umask. Bad masks are reported by line number, and output   */
+/* is written in large blocks, so one process can take a whole corpus */
+/* of masks instead of one process per mask.                          */
+static
+int run_masks(char * base_string, int convert, int symbolic,
+              int null_delimited, char * arg0)
+{
+    char * (* format)(mode_t, char *) = 0;
+    char delimiter = null_delimited ? '\0' : '\n';
+    char * output = malloc(MASKS_BUFFER_SIZE);
+    char * output_end = output;
+    size_t input_size = MASKS_BUFFER_SIZE;
+    char * input = malloc(input_size + 1);
+    size_t used = 0;
+    unsigned long line = 0;
+    int end_of_input = 0;
+    int exit_status = EXIT_SUCCESS;
+    mode_t base;
+
+    if(!output || !input)
+    {
+        return error_reading_input(arg0);
+    }
+
+    /* Reading the umask means setting it, so put it right back: */
+    if(!base_string || umaskexec_parse_mask_octal(base_string, &base))
+    {
+        base = umask(0);
+        umask(base);
+        if(base_string && umaskexec_parse_mask_symbolic(base_string, &base))
+        {
+            return error_bad_mask(base_string, arg0);
+        }
+    }
+
+    if(convert)
+    {
+        format = symbolic ? umaskexec_format_mask_symbolic
+                          : umaskexec_format_mask_octal;
+    }
+
+    while(!end_of_input)
+    {
+        char * start = input;
+        char * end;
+        ssize_t got = read(STDIN_FILENO, input + used, input_size - used);
+        if(got == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return error_reading_input(arg0);
+        }
+        end = input + used + got;
+        if(!got)
+        {
+            end_of_input = 1;
+            /* The last mask need not be terminated: */
+            if(used)
+            {
+                *end++ = delimiter;
+            }
+        }
+
+        for(;;)
+        {
+            char * next = memchr(start, delimiter, end - start);
+            mode_t mask = base;
+            if(!next)
+            {
+                break;
+            }
+            *next = '\0';
+            line += 1;
+            if(umaskexec_parse_mask(start, &mask))
+            {
+                error_bad_mask_line(line, start, arg0);
+                exit_status = EXIT_FAILURE;
+            }
+            else
+            if(format)
+            {
+                if(output_end + UMASKEXEC_SYMBOLIC_SIZE
+                 > output + MASKS_BUFFER_SIZE)
+                {
+                    if(!write_all(STDOUT_FILENO, output, output_end - output))
+                    {
+                        return error_writing_output(arg0);
+                    }
+                    output_end = output;
+                }
+                output_end = format(mask, output_end);
+                *output_end++ = delimiter;
+            }
+            start = next + 1;
+        }
+
+        /* Keep the unfinished mask, making room if it fills the buffer: */
+        used = end - start;
+        memmove(input, start, used);
+        if(used == input_size)
+        {
+            char * bigger = realloc(input, input_size * 2 + 1);
+            if(!bigger)
+            {
+                return error_reading_input(arg0);
+            }
+            input = bigger;
+            input_size *= 2;
+        }
+    }
+
+    if(!write_all(STDOUT_FILENO, output, output_end - output))
+    {
+        return error_writing_output(arg0);
+    }
+    return exit_status;
+}
+
+
+/* --apply-tree walks a directory tree with a pool of threads sharing */
+/* one stack of directories still to list. Each directory is listed   */
+/* by one thread, which stats its entries relative to the open        */
+/* directory, strips the bits the mask forbids from each one, and     */
+/* pushes the subdirectories it found back onto the stack for any     */
+/* thread to take, so all threads stay busy on wide and deep trees.   */
+/*                                                                    */
+/* Every directory but the root is opened relative to its parent's   */
+/* fd, never by path, so swapping a directory on the way down for a   */
+/* symbolic link cannot lead the walk out of the tree, and no path    */
+/* gets too long to open however deep the tree is. Paths are only    */
+/* kept for messages.                                                 */
+
+struct tree_directory
+{
+    struct tree_directory * next;
+    /* Null for the root, which is opened before the walk starts: */
+    struct tree_directory * parent;
+    /* Once listed, open until every subdirectory has been opened: */
+    int fd;
+    unsigned long unopened;
+    char * name;
+    char * path;
+};
+
+struct tree
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct tree_directory * stack;
+    /* Threads listing a directory, which may push more: */
+    unsigned long busy;
+    pthread_mutex_t output_lock;
+    mode_t mask;
+    int dry_run;
+    char delimiter;
+    int failed;
+    char * arg0;
+    /* Whether to try io_uring, and whether any thread got to use it: */
+    int use_uring;
+    int used_uring;
+};
+
+/* Subdirectories found by listing a directory, in a list to push: */
+struct tree_found
+{
+    struct tree_directory * first;
+    struct tree_directory * last;
+    unsigned long count;
+};
+
+#ifdef URING
+/* A ring per thread, with room for a ring's worth of names to stat, */
+/* their statx results, and their completion results.                */
+struct uring
+{
+    int fd;
+    unsigned int entries;
+    unsigned int * sq_tail;
+    unsigned int * sq_mask;
+    unsigned int * sq_array;
+    struct io_uring_sqe * sqes;
+    unsigned int * cq_head;
+    unsigned int * cq_tail;
+    unsigned int * cq_mask;
+    struct io_uring_cqe * cqes;
+    void * sq_ring;
+    size_t sq_ring_size;
+    void * cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    char * names;
+    size_t names_size;
+    size_t * offsets;
+    struct statx * statx;
+    int * results;
+};
+
+#define URING_ENTRIES 256
+#endif
+
+#define TREE_OUTPUT_SIZE 8192
+
+struct tree_worker
+{
+    pthread_t thread;
+    struct tree * tree;
+#ifdef URING
+    /* Null if io_uring is not used by this thread: */
+    struct uring * ring;
+#endif
+    unsigned long inodes;
+    unsigned long violations;
+    unsigned long fixed;
+    char * output_end;
+    char output[TREE_OUTPUT_SIZE];
+};
+
+
+static
+void flush_tree_output(struct tree_worker * worker)
+{
+    struct tree * tree = worker->tree;
+    pthread_mutex_lock(&tree->output_lock);
+    if(!write_all(STDOUT_FILENO, worker->output,
+                  worker->output_end - worker->output))
+    {
+        error_writing_output(tree->arg0);
+        tree->failed = 1;
+    }
+    pthread_mutex_unlock(&tree->output_lock);
+    worker->output_end = worker->output;
+}
+
+
+/* Lists path, and name inside it if not null, as a violating file: */
+static
+void print_tree_path(struct tree_worker * worker, char * path, char * name)
+{
+    size_t path_length = strlen(path);
+    size_t name_length = name ? strlen(name) + 1 : 0;
+    if(path_length + name_length + 1 > TREE_OUTPUT_SIZE
+     - (size_t)(worker->output_end - worker->output))
+    {
+        flush_tree_output(worker);
+        if(path_length + name_length + 1 > TREE_OUTPUT_SIZE)
+        {
+            /* Absurdly long, but the list should still be complete: */
+            pthread_mutex_lock(&worker->tree->output_lock);
+            write_all(STDOUT_FILENO, path, path_length);
+            if(name)
+            {
+                write_all(STDOUT_FILENO, "/", 1);
+                write_all(STDOUT_FILENO, name, name_length - 1);
+            }
+            write_all(STDOUT_FILENO, &worker->tree->delimiter, 1);
+            pthread_mutex_unlock(&worker->tree->output_lock);
+            return;
+        }
+    }
+    memcpy(worker->output_end, path, path_length);
+    worker->output_end += path_length;
+    if(name)
+    {
+        *worker->output_end++ = '/';
+        memcpy(worker->output_end, name, name_length - 1);
+        worker->output_end += name_length - 1;
+    }
+    *worker->output_end++ = worker->tree->delimiter;
+}
+
+
+static
+void error_applying_mask(struct tree * tree, char * path, char * name)
+{
+    int errno_ = errno;
+    pthread_mutex_lock(&tree->output_lock);
+    if(write_string(STDERR_FILENO, tree->arg0)
+    && write_string(STDERR_FILENO, ": error applying mask: ")
+    && write_string(STDERR_FILENO, path)
+    && (!name
+     || (write_string(STDERR_FILENO, "/")
+      && write_string(STDERR_FILENO, name))))
+    {
+        errno = errno_;
+        write_perror("");
+    }
+    tree->failed = 1;
+    pthread_mutex_unlock(&tree->output_lock);
+}
+
+
+/* Strips the forbidden bits from name in the directory fd, or from */
+/* the directory fd itself if name is null. Symbolic links are not  */
+/* followed: their own mode is meaningless, and following one could */
+/* change a file outside the tree.                                  */
+static
+void fix_tree_mode(struct tree_worker * worker, int fd, mode_t mode,
+                   char * path, char * name)
+{
+    struct tree * tree = worker->tree;
+    int result;
+
+    if(!(mode & tree->mask))
+    {
+        return;
+    }
+    worker->violations += 1;
+    if(tree->dry_run)
+    {
+        print_tree_path(worker, path, name);
+        return;
+    }
+    mode = mode & 07777 & ~tree->mask;
+    if(!name)
+    {
+        result = fchmod(fd, mode);
+    }
+    else
+    {
+        result = fchmodat(fd, name, mode, AT_SYMLINK_NOFOLLOW);
+        /* That fails like this for a symbolic link, which is skipped   */
+        /* since it must have been swapped in after the stat, but glibc */
+        /* also fails like this for any file before 2.32, and until     */
+        /* 2.39 when /proc is not mounted, which must not go unnoticed: */
+        if(result && (errno == ENOTSUP || errno == EOPNOTSUPP))
+        {
+            int errno_ = errno;
+            struct stat status;
+            if(!fstatat(fd, name, &status, AT_SYMLINK_NOFOLLOW)
+            && S_ISLNK(status.st_mode))
+            {
+                return;
+            }
+            errno = errno_;
+        }
+    }
+    if(result)
+    {
+        error_applying_mask(tree, path, name);
+        return;
+    }
+    worker->fixed += 1;
+}
+
+
+static
+struct tree_directory * new_tree_directory(char * path, size_t path_length,
+                                           char * name,
+                                           struct tree_directory * parent)
+{
+    size_t name_length = name ? strlen(name) + 1 : 0;
+    struct tree_directory * directory = malloc(
+        sizeof(struct tree_directory) + path_length + name_length + 1);
+    if(!directory)
+    {
+        return 0;
+    }
+    directory->parent = parent;
+    directory->fd = -1;
+    directory->unopened = 0;
+    directory->path = (char *)(directory + 1);
+    memcpy(directory->path, path, path_length);
+    if(name)
+    {
+        directory->path[path_length] = '/';
+        memcpy(directory->path + path_length + 1, name, name_length - 1);
+    }
+    directory->path[path_length + name_length] = '\0';
+    directory->name = name ? directory->path + path_length + 1
+                           : directory->path;
+    return directory;
+}
+
+
+/* Called once each subdirectory has been opened: the last one closes */
+/* and frees the directory, which nothing else needs by then.         */
+static
+void release_tree_directory(struct tree * tree,
+                            struct tree_directory * directory)
+{
+    unsigned long unopened;
+    pthread_mutex_lock(&tree->lock);
+    directory->unopened -= 1;
+    unopened = directory->unopened;
+    pthread_mutex_unlock(&tree->lock);
+    if(!unopened)
+    {
+        close(directory->fd);
+        free(directory);
+    }
+}
+
+
+/* Fixes an entry of the directory fd, or adds it to found if it is */
+/* a directory, to be listed and then fixed:                        */
+static
+void add_tree_entry(struct tree_worker * worker, int fd,
+                    struct tree_directory * directory, char * name,
+                    mode_t mode, struct tree_found * found)
+{
+    worker->inodes += 1;
+    if(S_ISDIR(mode))
+    {
+        struct tree_directory * subdirectory = new_tree_directory(
+            directory->path, strlen(directory->path), name, directory);
+        if(!subdirectory)
+        {
+            error_applying_mask(worker->tree, directory->path, name);
+            return;
+        }
+        subdirectory->next = found->first;
+        found->first = subdirectory;
+        if(!found->last)
+        {
+            found->last = subdirectory;
+        }
+        found->count += 1;
+    }
+    else
+    if(!S_ISLNK(mode))
+    {
+        fix_tree_mode(worker, fd, mode, directory->path, name);
+    }
+}
+
+
+static
+void stat_tree_entry(struct tree_worker * worker, int fd,
+                     struct tree_directory * directory, char * name,
+                     struct tree_found * found)
+{
+    struct stat status;
+    if(fstatat(fd, name, &status, AT_SYMLINK_NOFOLLOW))
+    {
+        error_applying_mask(worker->tree, directory->path, name);
+        return;
+    }
+    add_tree_entry(worker, fd, directory, name, status.st_mode, found);
+}
+
+
+static
+int is_dot_or_dot_dot(char const * name)
+{
+    return name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]));
+}
+
+
+/* glibc's readdir is getdents64 into a large buffer, so this is one */
+/* syscall per many entries, and one fstatat per entry:              */
+static
+void list_with_stat(struct tree_worker * worker, int fd, DIR * stream,
+                    struct tree_directory * directory,
+                    struct tree_found * found)
+{
+    struct dirent * entry;
+    errno = 0;
+    while((entry = readdir(stream)))
+    {
+        if(!is_dot_or_dot_dot(entry->d_name))
+        {
+            stat_tree_entry(worker, fd, directory, entry->d_name, found);
+        }
+        errno = 0;
+    }
+    if(errno)
+    {
+        error_applying_mask(worker->tree, directory->path, 0);
+    }
+}
+
+
+#ifdef URING
+static
+void close_uring(struct uring * ring)
+{
+    if(ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if(ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if(ring->sq_ring != MAP_FAILED)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+    free(ring->names);
+    free(ring->offsets);
+    free(ring->statx);
+    free(ring->results);
+    free(ring);
+}
+
+
+/* Sets up a ring with raw syscalls, as liburing would. Returns null */
+/* if the kernel has no io_uring, or it is disabled or restricted:   */
+static
+struct uring * open_uring(void)
+{
+    struct io_uring_params parameters;
+    struct uring * ring = malloc(sizeof(struct uring));
+    unsigned char * sq;
+    unsigned char * cq;
+
+    if(!ring)
+    {
+        return 0;
+    }
+    memset(&parameters, 0, sizeof(parameters));
+    ring->fd = syscall(SYS_io_uring_setup, URING_ENTRIES, &parameters);
+    if(ring->fd == -1)
+    {
+        free(ring);
+        return 0;
+    }
+    ring->entries = parameters.sq_entries;
+    ring->sq_ring_size = parameters.sq_off.array
+                       + parameters.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = parameters.cq_off.cqes
+                       + parameters.cq_entries * sizeof(struct io_uring_cqe);
+    if(parameters.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_ring_size > ring->sq_ring_size)
+        {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sqes_size = parameters.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(0, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->sq_ring;
+    if(!(parameters.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring->cq_ring = mmap(0, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqes = mmap(0, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    ring->names_size = 4096;
+    ring->names = malloc(ring->names_size);
+    ring->offsets = malloc(ring->entries * sizeof(size_t));
+    ring->statx = malloc(ring->entries * sizeof(struct statx));
+    ring->results = malloc(ring->entries * sizeof(int));
+    if(ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED
+    || ring->sqes == MAP_FAILED || !ring->names || !ring->offsets
+    || !ring->statx || !ring->results)
+    {
+        close_uring(ring);
+        return 0;
+    }
+
+    sq = ring->sq_ring;
+    cq = ring->cq_ring;
+    ring->sq_tail = (unsigned int *)(sq + parameters.sq_off.tail);
+    ring->sq_mask = (unsigned int *)(sq + parameters.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + parameters.sq_off.array);
+    ring->cq_head = (unsigned int *)(cq + parameters.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + parameters.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + parameters.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + parameters.cq_off.cqes);
+    return ring;
+}
+
+
+/* Submits a statx for each of count names, and waits for them all, */
+/* leaving each result in results. Returns 0 if the ring failed, so */
+/* that the caller can give up on it.                               */
+static
+int statx_with_uring(struct uring * ring, int fd, unsigned int count)
+{
+    unsigned int tail = *ring->sq_tail;
+    unsigned int to_submit = count;
+    unsigned int completed = 0;
+    unsigned int index;
+
+    for(index = 0; index < count; index += 1)
+    {
+        unsigned int slot = tail & *ring->sq_mask;
+        struct io_uring_sqe * sqe = ring->sqes + slot;
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long)(ring->names + ring->offsets[index]);
+        sqe->len = STATX_TYPE | STATX_MODE;
+        sqe->off = (unsigned long)(ring->statx + index);
+        sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        sqe->user_data = index;
+        ring->sq_array[slot] = slot;
+        ring->results[index] = 1;
+        tail += 1;
+    }
+    /* The kernel must see the entries before it sees the new tail: */
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    while(completed < count)
+    {
+        unsigned int head = *ring->cq_head;
+        long submitted = syscall(SYS_io_uring_enter, ring->fd, to_submit,
+                                 count - completed, IORING_ENTER_GETEVENTS,
+                                 0, 0);
+        if(submitted == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        to_submit -= submitted;
+        while(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe * cqe = ring->cqes + (head & *ring->cq_mask);
+            ring->results[cqe->user_data] = cqe->res;
+            head += 1;
+            completed += 1;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 1;
+}
+
+
+/* Like list_with_stat, but a ring's worth of names at a time are */
+/* stat'ed with one io_uring_enter, so on network and overlay file */
+/* systems their latencies overlap instead of adding up. There is  */
+/* no io_uring chmod, so changing modes is still one at a time.    */
+static
+void list_with_uring(struct tree_worker * worker, int fd, DIR * stream,
+                     struct tree_directory * directory,
+                     struct tree_found * found)
+{
+    struct uring * ring = worker->ring;
+    int end_of_directory = 0;
+
+    while(!end_of_directory)
+    {
+        struct dirent * entry = 0;
+        unsigned int count = 0;
+        unsigned int index;
+        size_t used = 0;
+        int ring_works;
+
+        /* Names are copied, since readdir reuses its buffer: */
+        errno = 0;
+        while(count < ring->entries && (entry = readdir(stream)))
+        {
+            size_t size = strlen(entry->d_name) + 1;
+            if(is_dot_or_dot_dot(entry->d_name))
+            {
+                continue;
+            }
+            if(used + size > ring->names_size)
+            {
+                char * bigger = realloc(ring->names,
+                                        ring->names_size * 2 + size);
+                if(!bigger)
+                {
+                    error_applying_mask(worker->tree, directory->path,
+                                        entry->d_name);
+                    errno = 0;
+                    continue;
+                }
+                ring->names = bigger;
+                ring->names_size = ring->names_size * 2 + size;
+            }
+            ring->offsets[count] = used;
+            memcpy(ring->names + used, entry->d_name, size);
+            used += size;
+            count += 1;
+            errno = 0;
+        }
+        if(!entry)
+        {
+            end_of_directory = 1;
+            if(errno)
+            {
+                error_applying_mask(worker->tree, directory->path, 0);
+            }
+        }
+        if(!count)
+        {
+            break;
+        }
+
+        ring_works = statx_with_uring(ring, fd, count);
+        for(index = 0; index < count; index += 1)
+        {
+            char * name = ring->names + ring->offsets[index];
+            int result = ring->results[index];
+            /* Not completed, or a kernel which cannot do statx with */
+            /* io_uring yet (before 5.6), so do it the usual way:    */
+            if(result == 1 || result == -EINVAL)
+            {
+                ring_works &= result != -EINVAL;
+                stat_tree_entry(worker, fd, directory, name, found);
+            }
+            else
+            if(result < 0)
+            {
+                errno = -result;
+                error_applying_mask(worker->tree, directory->path, name);
+            }
+            else
+            {
+                add_tree_entry(worker, fd, directory, name,
+                               ring->statx[index].stx_mode, found);
+            }
+        }
+        if(!ring_works)
+        {
+            close_uring(ring);
+            worker->ring = 0;
+            list_with_stat(worker, fd, stream, directory, found);
+            return;
+        }
+    }
+}
+#endif
+
+
+#define TREE_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+
+/* Lists the directory, which it then frees, or leaves open for its */
+/* subdirectories to free once they have all been opened:           */
+static
+void list_tree_directory(struct tree_worker * worker,
+                         struct tree_directory * directory)
+{
+    struct tree * tree = worker->tree;
+    struct tree_found found;
+    struct stat status;
+    DIR * stream;
+    int fd = directory->fd;
+
+    if(directory->parent)
+    {
+        fd = openat(directory->parent->fd, directory->name, TREE_OPEN_FLAGS);
+        if(fd == -1)
+        {
+            error_applying_mask(tree, directory->path, 0);
+        }
+        release_tree_directory(tree, directory->parent);
+    }
+    /* The mode is from the open directory, not from the earlier stat */
+    /* of whatever had its name, in case it has been swapped since:   */
+    if(fd == -1 || fstat(fd, &status) || !(stream = fdopendir(fd)))
+    {
+        if(fd != -1)
+        {
+            error_applying_mask(tree, directory->path, 0);
+            close(fd);
+        }
+        free(directory);
+        return;
+    }
+
+    found.first = 0;
+    found.last = 0;
+    found.count = 0;
+#ifdef URING
+    if(worker->ring)
+    {
+        list_with_uring(worker, fd, stream, directory, &found);
+    }
+    else
+#endif
+    {
+        list_with_stat(worker, fd, stream, directory, &found);
+    }
+
+    /* Last, so that taking away bits from the directory cannot stop */
+    /* its own listing part way through:                             */
+    fix_tree_mode(worker, fd, status.st_mode, directory->path, 0);
+
+    /* The stream's fd goes with it, so subdirectories need their own: */
+    if(found.first)
+    {
+        directory->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if(directory->fd == -1)
+        {
+            error_applying_mask(tree, directory->path, 0);
+            while(found.first)
+            {
+                struct tree_directory * next = found.first->next;
+                free(found.first);
+                found.first = next;
+            }
+        }
+    }
+    closedir(stream);
+    if(!found.first)
+    {
+        free(directory);
+        return;
+    }
+    directory->unopened = found.count;
+
+    /* All subdirectories at once, so the lock is taken once: */
+    pthread_mutex_lock(&tree->lock);
+    found.last->next = tree->stack;
+    tree->stack = found.first;
+    pthread_cond_broadcast(&tree->wake);
+    pthread_mutex_unlock(&tree->lock);
+}
+
+
+static
+void * run_tree_worker(void * argument)
+{
+    struct tree_worker * worker = argument;
+    struct tree * tree = worker->tree;
+
+#ifdef URING
+    worker->ring = tree->use_uring ? open_uring() : 0;
+#endif
+    pthread_mutex_lock(&tree->lock);
+#ifdef URING
+    if(worker->ring)
+    {
+        tree->used_uring = 1;
+    }
+#endif
+    for(;;)
+    {
+        struct tree_directory * directory;
+
+        /* Done only when nothing is left, and nothing can be added: */
+        while(!tree->stack && tree->busy)
+        {
+            pthread_cond_wait(&tree->wake, &tree->lock);
+        }
+        directory = tree->stack;
+        if(!directory)
+        {
+            break;
+        }
+        tree->stack = directory->next;
+        tree->busy += 1;
+        pthread_mutex_unlock(&tree->lock);
+
+        list_tree_directory(worker, directory);
+
+        pthread_mutex_lock(&tree->lock);
+        tree->busy -= 1;
+        if(!tree->busy && !tree->stack)
+        {
+            pthread_cond_broadcast(&tree->wake);
+        }
+    }
+    pthread_mutex_unlock(&tree->lock);
+
+#ifdef URING
+    if(worker->ring)
+    {
+        close_uring(worker->ring);
+    }
+#endif
+    if(worker->output_end != worker->output)
+    {
+        flush_tree_output(worker);
+    }
+    return 0;
+}
+
+
+/* Writes "inodes=<n> violations=<n> fixed=<n> wall_us=<n>            */
+/* inodes_per_second=<n> engine=<stat|io_uring>" to stderr, so it stays */
+/* out of the list of files on stdout. Only modes actually changed are  */
+/* counted as fixed.                                                    */
+static
+void report_tree(unsigned long inodes, unsigned long violations,
+                 unsigned long fixed, struct timespec * start, int used_uring,
+                 char * arg0)
+{
+    char line[256];
+    char * end = line;
+    struct timespec now;
+    unsigned long elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - start->tv_sec) * 1000000UL
+            + now.tv_nsec / 1000 - start->tv_nsec / 1000;
+    if(!elapsed)
+    {
+        elapsed = 1;
+    }
+    end = append_field(end, "inodes=", inodes);
+    end = append_field(end, " violations=", violations);
+    end = append_field(end, " fixed=", fixed);
+    end = append_field(end, " wall_us=", elapsed);
+    end = append_field(end, " inodes_per_second=",
+                       (double)inodes * 1000000 / elapsed);
+    end = copy_string(end, used_uring ? " engine=io_uring" : " engine=stat");
+    *end++ = '\n';
+    if(!write_all(STDERR_FILENO, line, end - line))
+    {
+        error_writing_output(arg0);
+    }
+}
+
+
+static
+int run_tree(char * root, mode_t mask, int dry_run, int use_uring,
+             int null_delimited, unsigned long thread_count, char * arg0)
+{
+    struct tree tree;
+    struct tree_worker * workers;
+    struct tree_directory * directory;
+    struct timespec start;
+    unsigned long inodes = 0;
+    unsigned long violations = 0;
+    unsigned long fixed = 0;
+    unsigned long started;
+    unsigned long index;
+    size_t root_length = strlen(root);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* "dir/" would otherwise list as "dir//file": */
+    while(root_length > 1 && root[root_length - 1] == '/')
+    {
+        root_length -= 1;
+    }
+
+    tree.stack = 0;
+    tree.busy = 0;
+    tree.mask = mask & 0777;
+    tree.dry_run = dry_run;
+    tree.delimiter = null_delimited ? '\0' : '\n';
+    tree.failed = 0;
+    tree.arg0 = arg0;
+    tree.use_uring = use_uring;
+    tree.used_uring = 0;
+
+    /* -j takes any number, which must not overflow the size: */
+    workers = 0;
+    errno = ENOMEM;
+    if(thread_count <= (size_t)-1 / sizeof(struct tree_worker))
+    {
+        workers = malloc(thread_count * sizeof(struct tree_worker));
+    }
+    if(!workers
+    || pthread_mutex_init(&tree.lock, 0)
+    || pthread_mutex_init(&tree.output_lock, 0)
+    || pthread_cond_init(&tree.wake, 0))
+    {
+        error_applying_mask(&tree, root, 0);
+        return EXIT_FAILURE;
+    }
+
+    directory = new_tree_directory(root, root_length, 0, 0);
+    if(!directory)
+    {
+        error_applying_mask(&tree, root, 0);
+        return EXIT_FAILURE;
+    }
+    directory->fd = open(root, TREE_OPEN_FLAGS);
+    if(directory->fd == -1)
+    {
+        error_applying_mask(&tree, root, 0);
+        return EXIT_FAILURE;
+    }
+    directory->next = 0;
+    tree.stack = directory;
+
+    for(started = 0; started < thread_count; started += 1)
+    {
+        struct tree_worker * worker = workers + started;
+        worker->tree = &tree;
+        worker->inodes = 0;
+        worker->violations = 0;
+        worker->fixed = 0;
+        worker->output_end = worker->output;
+        if(pthread_create(&worker->thread, 0, run_tree_worker, worker))
+        {
+            /* Fewer threads still finish the tree: */
+            break;
+        }
+    }
+    if(!started)
+    {
+        run_tree_worker(workers);
+        inodes += workers->inodes;
+        violations += workers->violations;
+        fixed += workers->fixed;
+    }
+    for(index = 0; index < started; index += 1)
+    {
+        pthread_join(workers[index].thread, 0);
+        inodes += workers[index].inodes;
+        violations += workers[index].violations;
+        fixed += workers[index].fixed;
+    }
+
+    /* The root itself, besides everything under it: */
+    report_tree(inodes + 1, violations, fixed, &start, tree.used_uring,
+                arg0);
+    return tree.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/* CPU and NUMA node lists, like "0-3,8", are parsed into bit sets: */
+#define LIST_BITS 1024
+#define LONG_BITS (CHAR_BIT * sizeof(unsigned long))
+#define LIST_LONGS (LIST_BITS / LONG_BITS)
+
+static
+int parse_list(char const * string, unsigned long * bits)
+{
+    memset(bits, 0, LIST_LONGS * sizeof(unsigned long));
+    for(;;)
+    {
+        unsigned long first, last;
+        string = parse_digits(string, LIST_BITS - 1, &first);
+        if(!string)
+        {
+            return 0;
+        }
+        last = first;
+        if(*string == '-')
+        {
+            string = parse_digits(string + 1, LIST_BITS - 1, &last);
+            if(!string || last < first)
+            {
+                return 0;
+            }
+        }
+        for(; first <= last; first += 1)
+        {
+            bits[first / LONG_BITS] |= 1UL << (first % LONG_BITS);
+        }
+        if(!*string)
+        {
+            return 1;
+        }
+        if(*string != ',')
+        {
+            return 0;
+        }
+        string += 1;
+    }
+}
+
+
+/* Returns the index of the first length characters of string in the */
+/* null-terminated names, or -1 if they are not one of the names:     */
+static
+int find_name(char const * string, size_t length, char const * const * names)
+{
+    int name;
+    for(name = 0; names[name]; name += 1)
+    {
+        if(strlen(names[name]) == length
+        && !strncmp(names[name], string, length))
+        {
+            return name;
+        }
+    }
+    return -1;
+}
+
+
+/* Parses "<name>[:<number>]", where <name> is one of names, into the */
+/* index of the name, leaving number unchanged if it is not given:     */
+static
+int parse_named(char const * string, char const * const * names,
+                int * index, unsigned long maximum, unsigned long * number)
+{
+    size_t length = strcspn(string, ":");
+    *index = find_name(string, length, names);
+    if(*index == -1)
+    {
+        return 0;
+    }
+    return !string[length]
+        || parse_number(string + length + 1, 0, maximum, number);
+}
+
+
+static
+int parse_nice(char const * string, int * nice)
+{
+    unsigned long magnitude;
+    if(*string == '-')
+    {
+        if(!parse_number(string + 1, 0, 20, &magnitude))
+        {
+            return 0;
+        }
+        *nice = -(int)magnitude;
+        return 1;
+    }
+    if(!parse_number(string, 0, 19, &magnitude))
+    {
+        return 0;
+    }
+    *nice = magnitude;
+    return 1;
+}
+
+
+#ifdef __linux__
+/* Indexed by I/O priority class, as in linux/ioprio.h: */
+static char const * const ioprio_classes[] = {
+    "none", "realtime", "best-effort", "idle", 0
+};
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+static char const * const sched_names[] = {
+    "other", "batch", "idle", "fifo", "rr", 0
+};
+static int const sched_policies[] = {
+    SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO, SCHED_RR
+};
+#endif
+
+
+/* Resource limit names, as in prlimit and ulimit, with the resources */
+/* in the same order:                                                */
+static char const * const rlimit_names[] = {
+    "as", "core", "cpu", "data", "fsize", "nofile", "stack",
+#ifdef RLIMIT_LOCKS
+    "locks",
+#endif
+#ifdef RLIMIT_MEMLOCK
+    "memlock",
+#endif
+#ifdef RLIMIT_MSGQUEUE
+    "msgqueue",
+#endif
+#ifdef RLIMIT_NICE
+    "nice",
+#endif
+#ifdef RLIMIT_NPROC
+    "nproc",
+#endif
+#ifdef RLIMIT_RSS
+    "rss",
+#endif
+#ifdef RLIMIT_RTPRIO
+    "rtprio",
+#endif
+#ifdef RLIMIT_RTTIME
+    "rttime",
+#endif
+#ifdef RLIMIT_SIGPENDING
+    "sigpending",
+#endif
+    0
+};
+static int const rlimit_resources[] = {
+    RLIMIT_AS, RLIMIT_CORE, RLIMIT_CPU, RLIMIT_DATA, RLIMIT_FSIZE,
+    RLIMIT_NOFILE, RLIMIT_STACK,
+#ifdef RLIMIT_LOCKS
+    RLIMIT_LOCKS,
+#endif
+#ifdef RLIMIT_MEMLOCK
+    RLIMIT_MEMLOCK,
+#endif
+#ifdef RLIMIT_MSGQUEUE
+    RLIMIT_MSGQUEUE,
+#endif
+#ifdef RLIMIT_NICE
+    RLIMIT_NICE,
+#endif
+#ifdef RLIMIT_NPROC
+    RLIMIT_NPROC,
+#endif
+#ifdef RLIMIT_RSS
+    RLIMIT_RSS,
+#endif
+#ifdef RLIMIT_RTPRIO
+    RLIMIT_RTPRIO,
+#endif
+#ifdef RLIMIT_RTTIME
+    RLIMIT_RTTIME,
+#endif
+#ifdef RLIMIT_SIGPENDING
+    RLIMIT_SIGPENDING,
+#endif
+};
+#define RLIMIT_COUNT (sizeof(rlimit_resources) / sizeof(*rlimit_resources))
+
+
+/* The --fd, --dirfd, report, status and trace fds: */
+#define KEEP_FDS_SIZE 5
+
+/* Process attributes which commands inherit, set once in this process */
+/* right after the mask, so that one exec replaces a chain of wrappers */
+/* like env -C, prlimit, taskset, numactl, nice, ionice and chrt:     */
+struct process_setup
+{
+    char * directory;
+    int close_fds;
+    /* Open file descriptors to keep anyway: */
+    int keep_fds[KEEP_FDS_SIZE];
+    unsigned int keep_fd_count;
+    char have_limit[RLIMIT_COUNT];
+    struct rlimit limits[RLIMIT_COUNT];
+    int have_cpus;
+    unsigned long cpus[LIST_LONGS];
+    /* 0, or a set_mempolicy mode: */
+    int memory_policy;
+    unsigned long nodes[LIST_LONGS];
+    int have_nice;
+    int nice;
+    /* -1, or an ioprio_set value: */
+    int ioprio;
+    /* -1, or a sched_setscheduler policy: */
+    int sched_policy;
+    int sched_priority;
+};
+
+
+static
+void init_setup(struct process_setup * setup)
+{
+    setup->directory = 0;
+    setup->close_fds = 0;
+    setup->keep_fd_count = 0;
+    memset(setup->have_limit, 0, sizeof(setup->have_limit));
+    setup->have_cpus = 0;
+    setup->memory_policy = 0;
+    setup->have_nice = 0;
+    setup->ioprio = -1;
+    setup->sched_policy = -1;
+}
+
+
+static
+char const * parse_limit(char const * string, rlim_t * limit)
+{
+    unsigned long value;
+    if(!strncmp(string, "unlimited", 9))
+    {
+        *limit = RLIM_INFINITY;
+        return string + 9;
+    }
+    string = parse_digits(string, (unsigned long)-1, &value);
+    *limit = value;
+    return string;
+}
+
+
+/* Parses "<resource>=<soft>[:<hard>]", where a lone <soft> is both: */
+static
+int parse_rlimit(char const * string, struct process_setup * setup)
+{
+    size_t length = strcspn(string, "=");
+    int resource = find_name(string, length, rlimit_names);
+    struct rlimit limit;
+    if(resource == -1 || !string[length])
+    {
+        return 0;
+    }
+    string = parse_limit(string + length + 1, &limit.rlim_cur);
+    if(!string)
+    {
+        return 0;
+    }
+    limit.rlim_max = limit.rlim_cur;
+    if(*string == ':')
+    {
+        string = parse_limit(string + 1, &limit.rlim_max);
+        if(!string)
+        {
+            return 0;
+        }
+    }
+    if(*string)
+    {
+        return 0;
+    }
+    setup->have_limit[resource] = 1;
+    setup->limits[resource] = limit;
+    return 1;
+}
+
+
+/* Closes the descriptors from first to last, inclusive, which is one */
+/* syscall with close_range, instead of one per possible descriptor:  */
+static
+void close_fd_range(unsigned int first, unsigned int last)
+{
+    long maximum;
+#ifdef SYS_close_range
+    if(!syscall(SYS_close_range, first, last, 0) || errno != ENOSYS)
+    {
+        return;
+    }
+#endif
+    maximum = sysconf(_SC_OPEN_MAX);
+    if(maximum == -1)
+    {
+        maximum = 1024;
+    }
+    for(; first <= last && first < (unsigned long)maximum; first += 1)
+    {
+        close(first);
+    }
+}
+
+
+static
+void keep_fd(struct process_setup * setup, int fd)
+{
+    if(fd != -1)
+    {
+        setup->keep_fds[setup->keep_fd_count] = fd;
+        setup->keep_fd_count += 1;
+    }
+}
+
+
+/* Closes everything but stdin, stdout, stderr and the kept fds: */
+static
+void close_fds(struct process_setup * setup)
+{
+    int * keep_fds = setup->keep_fds;
+    unsigned int count = setup->keep_fd_count;
+    unsigned int first = STDERR_FILENO + 1;
+    unsigned int index;
+
+    /* Sorted, so that the gaps between them can be closed in order: */
+    for(index = 1; index < count; index += 1)
+    {
+        int fd = keep_fds[index];
+        unsigned int place = index;
+        for(; place && keep_fds[place - 1] > fd; place -= 1)
+        {
+            keep_fds[place] = keep_fds[place - 1];
+        }
+        keep_fds[place] = fd;
+    }
+    for(index = 0; index < count; index += 1)
+    {
+        unsigned int fd = keep_fds[index];
+        if(fd < first)
+        {
+            continue;
+        }
+        if(fd > first)
+        {
+            close_fd_range(first, fd - 1);
+        }
+        first = fd + 1;
+    }
+    close_fd_range(first, ~0U);
+}
+
+
+static
+int apply_setup(struct process_setup * setup, char * arg0)
+{
+    unsigned int resource;
+    if(setup->directory && chdir(setup->directory))
+    {
+        return error_setting("directory", arg0);
+    }
+    if(setup->close_fds)
+    {
+        close_fds(setup);
+    }
+    for(resource = 0; resource < RLIMIT_COUNT; resource += 1)
+    {
+        if(setup->have_limit[resource]
+        && setrlimit(rlimit_resources[resource], setup->limits + resource))
+        {
+            return error_setting("resource limit", arg0);
+        }
+    }
+#ifdef __linux__
+    if(setup->have_cpus)
+    {
+        cpu_set_t cpus;
+        unsigned long cpu;
+        CPU_ZERO(&cpus);
+        for(cpu = 0; cpu < LIST_BITS && cpu < CPU_SETSIZE; cpu += 1)
+        {
+            if(setup->cpus[cpu / LONG_BITS] & (1UL << (cpu % LONG_BITS)))
+            {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        if(sched_setaffinity(0, sizeof(cpus), &cpus))
+        {
+            return error_setting("CPU affinity", arg0);
+        }
+    }
+    if(setup->memory_policy)
+    {
+        /* glibc has no wrapper, and libnuma is not worth linking for it: */
+        if(syscall(SYS_set_mempolicy, setup->memory_policy, setup->nodes,
+                   LIST_BITS + 1))
+        {
+            return error_setting("memory policy", arg0);
+        }
+    }
+    /* Before the nice value, which some policies ignore but preserve: */
+    if(setup->sched_policy != -1)
+    {
+        struct sched_param parameters;
+        parameters.sched_priority = setup->sched_priority;
+        if(sched_setscheduler(0, setup->sched_policy, &parameters))
+        {
+            return error_setting("scheduling policy", arg0);
+        }
+    }
+    if(setup->ioprio != -1)
+    {
+        if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, setup->ioprio))
+        {
+            return error_setting("I/O priority", arg0);
+        }
+    }
+#endif
+    if(setup->have_nice)
+    {
+        if(setpriority(PRIO_PROCESS, 0, setup->nice))
+        {
+            return error_setting("nice value", arg0);
+        }
+    }
+    return 1;
+}
+
+
+#ifdef __linux__
+/* Runs the command as a child which starts in the cgroup directory, */
+/* so everything it does is accounted to that cgroup, and there is   */
+/* no separate write to migrate it. Without clone3 or its cgroup     */
+/* support, the child migrates itself before exec'ing instead.       */
+static
+int cgroup_command(char * cgroup, char * * argv, char * arg0)
+{
+    int cgroup_fd = open(cgroup, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    pid_t pid = -1;
+
+    if(cgroup_fd == -1)
+    {
+        error_setting("cgroup", arg0);
+        return EXIT_FAILURE;
+    }
+    signal(SIGCHLD, SIG_DFL);
+
+#if defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+    {
+        struct clone_args args;
+        memset(&args, 0, sizeof(args));
+        args.flags = CLONE_INTO_CGROUP;
+        args.exit_signal = SIGCHLD;
+        args.cgroup = cgroup_fd;
+        /* Without CLONE_VM this is a fork, so it returns twice: */
+        pid = syscall(SYS_clone3, &args, sizeof(args));
+        if(!pid)
+        {
+            _exit(execute_command(argv, arg0));
+        }
+    }
+    /* Too old for clone3 (ENOSYS) or for its cgroup field (E2BIG, or */
+    /* EINVAL for the flag). Other errors are real and reported:      */
+    if(pid == -1 && errno != ENOSYS && errno != E2BIG && errno != EINVAL)
+    {
+        error_setting("cgroup", arg0);
+        return EXIT_FAILURE;
+    }
+#endif
+
+    if(pid == -1)
+    {
+        pid = fork();
+        if(!pid)
+        {
+            /* Writing 0 to cgroup.procs moves the writing process: */
+            int procs_fd = openat(cgroup_fd, "cgroup.procs",
+                                  O_WRONLY | O_CLOEXEC);
+            if(procs_fd == -1 || write(procs_fd, "0", 1) != 1)
+            {
+                error_setting("cgroup", arg0);
+                _exit(EXIT_FAILURE);
+            }
+            _exit(execute_command(argv, arg0));
+        }
+        if(pid == -1)
+        {
+            return error_executing_command(*argv, arg0);
+        }
+    }
+    close(cgroup_fd);
+    return wait_for_command(pid, arg0);
+}
+#endif
+
+
+int main(int argc, char * * argv)
+{
+    char * arg;
+    char * arg0 = *argv;
+
+    /* Only for telling masks from options, so never used as the mask: */
+    mode_t ignored_mask = 0;
+
+    /* Function pointer holds octal or symbolic mask printing choice: */
+    int (* print_mask)(char * arg0) = print_mask_octal;
+
+    /* Function pointer holds exec or spawn-and-wait choice: */
+    int (* execute)(char * * argv, char * arg0) = execute_command;
+
+    /* Batch mode runs commands from a file instead of the arguments, */
+    /* args0 mode runs the command with arguments appended from stdin: */
+    char * batch_file = 0;
+    unsigned long status_fd = -1;
+    int args0 = 0;
+    int null_delimited = 0;
+    unsigned long job_count = 1;
+
+    /* Executing an open file or relative to an open directory: */
+    unsigned long exec_fd = -1;
+    unsigned long exec_directory_fd = -1;
+
+    /* Directory tree to take the forbidden bits away from, if any: */
+    char * tree = 0;
+    int dry_run = 0;
+    int use_uring = 0;
+    int jobs_given = 0;
+
+    /* Mask stream mode: 0, or 1 to check masks, or 2 to also convert: */
+    int masks = 0;
+
+    /* Cgroup directory to run the command in, if any: */
+    char * cgroup = 0;
+
+    /* Spawn server socket to listen on, or to run the command through: */
+    char * serve_path = 0;
+    char * via_path = 0;
+
+    /* Everything else to set up in the process before running anything: */
+    struct process_setup setup;
+    init_setup(&setup);
+    report.fd = -1;
+
+    trace_start();
+
+    /* Without any arguments (two, counting argv[0]), just print the mask: */
+    if(argc < 2)
+    {
+        /* Many systems allow execution without even the zeroth argument: */
+        if(!arg0)
+        {
+            arg0 = "";
+        }
+        return print_mask(arg0);
+    }
+
+    /* The goal is to shift argv until it points to the command to execute: */
+    argv += 1;
+
+    /* Arguments are options (starting with '-') until the mask: */
+    while((arg = *argv) && *arg == '-')
+    {
+        /* Shift argv past the consumed option: */
+        argv += 1;
+        arg += 1;
+
+        if(!strcmp(arg, "-help") || !strcmp(arg, "h"))
+        {
+            return print_help(arg0);
+        }
+        if(!strcmp(arg, "-version") || !strcmp(arg, "V"))
+        {
+            return print_version(arg0);
+        }
+
+        if(!strcmp(arg, "-symbolic") || !strcmp(arg, "S"))
+        {
+            print_mask = print_mask_symbolic;
+        }
+        else
+        if(!strcmp(arg, "-spawn"))
+        {
+            execute = spawn_command;
+        }
+        else
+        if(!strcmp(arg, "-init"))
+        {
+            execute = init_command;
+        }
+        else
+        if(!strcmp(arg, "-batch"))
+        {
+            batch_file = *argv;
+            if(!batch_file)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-serve"))
+        {
+            serve_path = *argv;
+            if(!serve_path)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-via"))
+        {
+            via_path = *argv;
+            if(!via_path)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-status-fd"))
+        {
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_number(*argv, 0, INT_MAX, &status_fd))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-fd") || !strcmp(arg, "-dirfd"))
+        {
+            unsigned long * fd = arg[1] == 'f' ? &exec_fd : &exec_directory_fd;
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_number(*argv, 0, INT_MAX, fd))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            argv += 1;
+        }
+        else
+#ifdef __linux__
+        if(!strcmp(arg, "-cpus"))
+        {
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_list(*argv, setup.cpus))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            setup.have_cpus = 1;
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-membind") || !strcmp(arg, "-interleave"))
+        {
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_list(*argv, setup.nodes))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            setup.memory_policy = arg[1] == 'm' ? MPOL_BIND : MPOL_INTERLEAVE;
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-cgroup"))
+        {
+            cgroup = *argv;
+            if(!cgroup)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-ioprio"))
+        {
+            int class;
+            unsigned long level = -1;
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_named(*argv, ioprio_classes, &class, 7, &level))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            /* The kernel only takes level 0 for the classes without one: */
+            if(level == (unsigned long)-1)
+            {
+                level = class == IOPRIO_CLASS_RT || class == IOPRIO_CLASS_BE
+                      ? 4 : 0;
+            }
+            setup.ioprio = class << IOPRIO_CLASS_SHIFT | level;
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-sched"))
+        {
+            int name;
+            unsigned long priority = -1;
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_named(*argv, sched_names, &name, 99, &priority))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            /* The real-time policies take 1 to 99, the others only 0: */
+            if(priority == (unsigned long)-1)
+            {
+                priority = sched_policies[name] == SCHED_FIFO
+                        || sched_policies[name] == SCHED_RR;
+            }
+            setup.sched_policy = sched_policies[name];
+            setup.sched_priority = priority;
+            argv += 1;
+        }
+        else
+#endif
+        if(!strcmp(arg, "-chdir"))
+        {
+            setup.directory = *argv;
+            if(!setup.directory)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            argv += 1;
+        }
+        else
+        /* Only commands see the environment, so it is edited right away, */
+        /* in the order given, instead of with the rest of the setup:      */
+        if(!strcmp(arg, "-setenv"))
+        {
+            char * value;
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            value = strchr(*argv, '=');
+            if(!value || value == *argv)
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            *value = '\0';
+            if(setenv(*argv, value + 1, 1))
+            {
+                return error_setting("environment", arg0);
+            }
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-unsetenv"))
+        {
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!**argv || strchr(*argv, '='))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            if(unsetenv(*argv))
+            {
+                return error_setting("environment", arg0);
+            }
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-rlimit"))
+        {
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_rlimit(*argv, &setup))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-close-fds"))
+        {
+            setup.close_fds = 1;
+        }
+        else
+        if(!strcmp(arg, "-nice"))
+        {
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_nice(*argv, &setup.nice))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            setup.have_nice = 1;
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-rusage")
+#ifdef __linux__
+        || !strcmp(arg, "-perf-stat")
+#endif
+        )
+        {
+            unsigned long fd;
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_number(*argv, 0, INT_MAX, &fd))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            report.fd = fd;
+#ifdef __linux__
+            if(arg[1] == 'p')
+            {
+                report.perf_stat = 1;
+            }
+#endif
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-apply-tree"))
+        {
+            tree = *argv;
+            if(!tree)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            argv += 1;
+        }
+        else
+        if(!strcmp(arg, "-dry-run"))
+        {
+            dry_run = 1;
+        }
+        else
+#ifdef URING
+        if(!strcmp(arg, "-io-uring"))
+        {
+            use_uring = 1;
+        }
+        else
+#endif
+        if(!strcmp(arg, "-check") || !strcmp(arg, "-convert"))
+        {
+            masks = arg[2] == 'h' ? 1 : 2;
+        }
+        else
+        if(!strcmp(arg, "-args0"))
+        {
+            args0 = 1;
+        }
+        else
+        if(!strcmp(arg, "-null") || !strcmp(arg, "0"))
+        {
+            null_delimited = 1;
+        }
+        else
+        if(!strcmp(arg, "-jobs") || !strcmp(arg, "j"))
+        {
+            if(!*argv)
+            {
+                return error_missing_option_argument(arg - 1, arg0);
+            }
+            if(!parse_number(*argv, 1, (unsigned long)-1, &job_count))
+            {
+                return error_bad_option_argument(arg - 1, *argv, arg0);
+            }
+            jobs_given = 1;
+            argv += 1;
+        }
+        else
+        /* The "end of options" ("--") "option" leaves just the mask: */
+        if(!strcmp(arg, "-"))
+        {
+            arg = *argv;
+            break;
+        }
+        else
+        /* Symbolic masks like "-w" start with '-' too, and no option is */
+        /* also a mask, so one which is not an option is the mask:       */
+        if(!umaskexec_parse_mask(arg - 1, &ignored_mask))
+        {
+            argv -= 1;
+            arg = *argv;
+            break;
+        }
+        else
+        {
+            return error_bad_option(arg - 1, arg0);
+        }
+    }
+
+    /* Now arg should be the mask, if there is one. */
+    trace_point("options", 0);
+    PROBE1(options, arg);
+
+    /* In mask stream mode, the mask is only the base for the stream: */
+    if(masks)
+    {
+        return run_masks(arg, masks == 2, print_mask == print_mask_symbolic,
+                         null_delimited, arg0);
+    }
+
+    keep_fd(&setup, exec_fd);
+    keep_fd(&setup, exec_directory_fd);
+    keep_fd(&setup, report.fd);
+    keep_fd(&setup, status_fd);
+    if(trace.on)
+    {
+        keep_fd(&setup, trace.fd);
+    }
+
+    if(arg && !parse_and_use_mask(arg))
+    {
+        return error_bad_mask(arg, arg0);
+    }
+    trace_point("mask", 0);
+
+    /* The tree walk runs here, so it gets the same setup a command gets: */
+    if(tree)
+    {
+        mode_t mask = umask(0);
+        struct rlimit limit;
+        umask(mask);
+        if(cgroup || report.fd != -1 || status_fd != (unsigned long)-1)
+        {
+            return error_bad_option(cgroup ? "--cgroup"
+                                    : report.fd != -1 ? "--rusage"
+                                    : "--status-fd", arg0);
+        }
+        /* Each directory on the way down stays open until its             */
+        /* subdirectories are, so a deep tree takes about as many fds as   */
+        /* it has levels. Raised before the setup, so --rlimit still wins: */
+        if(!getrlimit(RLIMIT_NOFILE, &limit)
+        && limit.rlim_cur < limit.rlim_max)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+        if(!apply_setup(&setup, arg0))
+        {
+            return EXIT_FAILURE;
+        }
+        trace_point("setup", 0);
+#ifdef _SC_NPROCESSORS_ONLN
+        if(!jobs_given)
+        {
+            long processors = sysconf(_SC_NPROCESSORS_ONLN);
+            if(processors > 1)
+            {
+                job_count = processors;
+            }
+        }
+#endif
+        return run_tree(tree, mask, dry_run, use_uring, null_delimited,
+                        job_count, arg0);
+    }
+
+    /* In batch mode, the mask is only the base for relative masks: */
+    if(batch_file)
+    {
+        if(cgroup || report.fd != -1)
+        {
+            return error_bad_option(cgroup ? "--cgroup" : "--rusage", arg0);
+        }
+        if(!apply_setup(&setup, arg0))
+        {
+            return EXIT_FAILURE;
+        }
+        trace_point("setup", 0);
+        trace_flush();
+        return run_batch(batch_file, null_delimited, job_count, status_fd,
+                         arg0);
+    }
+    if(status_fd != (unsigned long)-1)
+    {
+        return error_bad_option("--status-fd", arg0);
+    }
+
+    /* In server mode, the mask and setup are applied once, inherited */
+    /* by every zygote, and relative --via masks are already resolved: */
+    if(serve_path)
+    {
+        if(cgroup || report.fd != -1)
+        {
+            return error_bad_option(cgroup ? "--cgroup" : "--rusage", arg0);
+        }
+        if(!apply_setup(&setup, arg0))
+        {
+            return EXIT_FAILURE;
+        }
+        trace_point("setup", 0);
+        trace_flush();
+        return run_server(serve_path, job_count, arg0);
+    }
+
+    /* No more arguments after parsing options? Print the mask: */
+    if(!arg)
+    {
+        return print_mask(arg0);
+    }
+
+    /* Shift argv past the mask, leaving just the command in argv: */
+    argv += 1;
+
+    arg = *argv;
+    /* Now arg should be the command to execute. */
+
+    if(!arg)
+    {
+        /* If no command was given, just print the new mask: */
+        return print_mask(arg0);
+    }
+
+    if(!apply_setup(&setup, arg0))
+    {
+        return EXIT_FAILURE;
+    }
+    trace_point("setup", 0);
+
+    /* The server runs the command, so only what is sent reaches it: */
+    /* stdio, the directory, the environment and the mask.           */
+    if(via_path)
+    {
+        if(execute != execute_command || args0 || cgroup
+        || report.fd != -1 || exec_fd != (unsigned long)-1
+        || exec_directory_fd != (unsigned long)-1)
+        {
+            return error_bad_option("--via", arg0);
+        }
+        return run_via(via_path, argv, arg0);
+    }
+
+    if(exec_fd != (unsigned long)-1 || exec_directory_fd != (unsigned long)-1)
+    {
+        /* Those need the command to be a path, not an open file: */
+        if(execute != execute_command || args0 || cgroup
+        || report.fd != -1)
+        {
+            return error_bad_option(exec_fd != (unsigned long)-1 ? "--fd"
+                                                                 : "--dirfd",
+                                    arg0);
+        }
+        return execute_fd(exec_fd, exec_directory_fd, argv, arg0);
+    }
+
+    /* Usage can only be reported by waiting for the command: */
+    if(report.fd != -1)
+    {
+        if(args0)
+        {
+            return error_bad_option("--rusage", arg0);
+        }
+        /* --cgroup already waits: */
+        if(execute == execute_command && !cgroup)
+        {
+            execute = spawn_command;
+        }
+#ifdef __linux__
+        /* Counters need a child which waits for them before exec'ing: */
+        if(report.perf_stat)
+        {
+            if(execute != spawn_command)
+            {
+                return error_bad_option("--perf-stat", arg0);
+            }
+            execute = perf_command;
+        }
+#endif
+        clock_gettime(CLOCK_MONOTONIC, &report.start);
+    }
+    if(cgroup)
+    {
+        /* That is its own way of running the command: */
+        if(execute != execute_command || args0)
+        {
+            return error_bad_option("--cgroup", arg0);
+        }
+#ifdef __linux__
+        return cgroup_command(cgroup, argv, arg0);
+#endif
+    }
+    if(args0)
+    {
+        trace_flush();
+        return run_args0(argv, job_count, arg0);
+    }
+    return execute(argv, arg0);
 }
@@ -0,0 +1,226 @@
+/* SPDX-License-Identifier: 0BSD */
+/* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
+
+/* Header-only C++14 counterpart of the libumaskexec parsers, which   */
+/* can be evaluated at compile time. It accepts exactly the grammar   */
+/* of umaskexec masks, and reports the same error offsets.            */
+/*                                                                    */
+/* A symbolic mask can be relative to the old mask, which is only     */
+/* known at run time, so the result is a pair of bit sets: the old    */
+/* mask bits to keep, and the bits to set. Usage:                     */
+/*                                                                    */
+/*     constexpr auto mask = umaskexec::parse_or_throw("u=rwx,g=rx"); */
+/*     umaskexec::use(mask);                                          */
+/*                                                                    */
+/* A bad mask in a constexpr context like that fails the build.       */
+
+#ifndef UMASKEXEC_HPP
+#define UMASKEXEC_HPP
+
+/* Standard C++ library headers */
+#include <cstddef> /* std::size_t */
+#include <stdexcept> /* std::invalid_argument */
+
+/* Standard UNIX/Linux (POSIX/SUS base) headers */
+#include <sys/stat.h> /* S_I*, umask */
+#include <sys/types.h> /* mode_t */
+
+
+namespace umaskexec
+{
+
+struct mask
+{
+    mode_t keep;
+    mode_t set;
+
+    constexpr mode_t apply(mode_t old_mask) const
+    {
+        return (old_mask & keep) | set;
+    }
+};
+
+
+struct parse_result
+{
+    /* Only meaningful if error is false: */
+    umaskexec::mask mask;
+    /* Only meaningful if error is true: */
+    std::size_t error_offset;
+    bool error;
+};
+
+
+constexpr parse_result parse_octal(char const * mask_string)
+{
+    mode_t new_mask = 0;
+    std::size_t index = 0;
+    char character = mask_string[index];
+    do
+    {
+        if(character < '0' || character > '7')
+        {
+            return parse_result{mask{0, 0}, index, true};
+        }
+        new_mask <<= 3;
+        new_mask += character - '0';
+        if(new_mask > 0777)
+        {
+            return parse_result{mask{0, 0}, index, true};
+        }
+        index += 1;
+        character = mask_string[index];
+    }
+    while(character != '\0');
+    return parse_result{mask{0, new_mask}, 0, false};
+}
+
+
+constexpr parse_result parse_symbolic(char const * mask_string)
+{
+    /* mask bits combined by permission type: */
+    mode_t const r_bits = S_IRUSR | S_IRGRP | S_IROTH;
+    mode_t const w_bits = S_IWUSR | S_IWGRP | S_IWOTH;
+    mode_t const x_bits = S_IXUSR | S_IXGRP | S_IXOTH;
+
+    /* mask bits combined by who they apply to: */
+    mode_t const u_bits = S_IRUSR | S_IWUSR | S_IXUSR;
+    mode_t const g_bits = S_IRGRP | S_IWGRP | S_IXGRP;
+    mode_t const o_bits = S_IROTH | S_IWOTH | S_IXOTH;
+    mode_t const a_bits = u_bits | g_bits | o_bits;
+
+    /* new mask starts as the old mask (all kept), then is updated: */
+    mode_t keep = a_bits;
+    mode_t set = 0;
+    std::size_t index = 0;
+
+    for(;;)
+    {
+        mode_t u_g_o_a_target = 0;
+        char character = '\0';
+
+        for(;;)
+        {
+            character = mask_string[index++];
+            if(character == 'u') u_g_o_a_target |= u_bits;
+            else
+            if(character == 'g') u_g_o_a_target |= g_bits;
+            else
+            if(character == 'o') u_g_o_a_target |= o_bits;
+            else
+            if(character == 'a') u_g_o_a_target |= a_bits;
+            else
+            break;
+        }
+
+        if(!u_g_o_a_target)
+        {
+            u_g_o_a_target = a_bits;
+        }
+
+        do
+        {
+            char operation = character;
+            mode_t permissions = 0;
+
+            if(operation != '=' && operation != '+' && operation != '-')
+            {
+                return parse_result{mask{0, 0}, index - 1, true};
+            }
+
+            for(;;)
+            {
+                character = mask_string[index++];
+                if(character == 'r') permissions |= r_bits;
+                else
+                if(character == 'w') permissions |= w_bits;
+                else
+                if(character == 'x') permissions |= x_bits;
+                else
+                break;
+            }
+            permissions &= u_g_o_a_target;
+
+            /* '-' sets mask bits, '+' clears them, and '=' sets all */
+            /* targeted bits before clearing the listed ones:        */
+            if(operation == '-')
+            {
+                set |= permissions;
+            }
+            else
+            {
+                if(operation == '=')
+                {
+                    set |= u_g_o_a_target;
+                }
+                keep &= ~permissions;
+                set &= ~permissions;
+            }
+
+            if(character == '\0')
+            {
+                return parse_result{mask{keep, set}, 0, false};
+            }
+        }
+        while(character != ',');
+    }
+}
+
+
+/* Octal if it parses as octal, otherwise symbolic: */
+constexpr parse_result parse(char const * mask_string)
+{
+    parse_result result = parse_octal(mask_string);
+    if(!result.error)
+    {
+        return result;
+    }
+    result = parse_symbolic(mask_string);
+
+    /* Something starting with a digit was meant to be octal: */
+    if(result.error && *mask_string >= '0' && *mask_string <= '9')
+    {
+        return parse_octal(mask_string);
+    }
+    return result;
+}
+
+
+/* Throwing is not allowed in a constant expression, so in one, */
+/* a bad mask is a compile error:                               */
+constexpr umaskexec::mask parse_or_throw(char const * mask_string)
+{
+    parse_result const result = parse(mask_string);
+    if(result.error)
+    {
+        throw std::invalid_argument("bad mask");
+    }
+    return result.mask;
+}
+
+
+#if defined(__cpp_consteval)
+/* Same, but guaranteed to be evaluated at compile time: */
+consteval umaskexec::mask literal(char const * mask_string)
+{
+    return parse_or_throw(mask_string);
+}
+#endif
+
+
+/* Set the process umask, reading the old one only if needed: */
+inline void use(umaskexec::mask mask)
+{
+    if(mask.keep)
+    {
+        umask(mask.apply(umask(0)));
+    }
+    else
+    {
+        umask(mask.set);
+    }
+}
+
+}  /* namespace umaskexec */
+
+#endif /* UMASKEXEC_HPP */
@@ -0,0 +1,178 @@
+/* SPDX-License-Identifier: 0BSD */
+/* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
+
+/* Bash loadable builtin version of umaskexec (enable -f). Scripts   */
+/* which run "umaskexec <mask> <command>" then pay for one fork and  */
+/* one exec of the command, instead of also exec'ing umaskexec. The  */
+/* mask is only set in the child, never in the shell itself.         */
+/*                                                                   */
+/* Built against the headers from bash's examples/loadables, which   */
+/* distributions ship as bash-builtins or bash-devel (bash 5.x).     */
+
+#include <config.h>
+
+/* Standard C library headers */
+#include <stdio.h> /* fflush, printf, stderr */
+#include <string.h> /* strcmp */
+
+/* Standard UNIX/Linux (POSIX/SUS base) headers */
+#include <sys/stat.h> /* umask */
+#include <sys/types.h> /* mode_t, pid_t */
+#include <unistd.h> /* _exit */
+
+/* Bash headers */
+#include "builtins.h"
+#include "shell.h"
+#include "execute_cmd.h" /* shell_execve */
+#include "findcmd.h" /* search_for_command */
+#include "jobs.h" /* make_child, wait_for */
+#include "trap.h" /* restore_original_signals */
+#include "common.h" /* builtin_*, sh_chkwrite, sh_invalidopt */
+
+#include "libumaskexec.h"
+
+
+static
+int print_mask(mode_t mask, int symbolic)
+{
+    char mask_string[UMASKEXEC_SYMBOLIC_SIZE];
+    if(symbolic)
+    {
+        umaskexec_format_mask_symbolic(mask, mask_string);
+    }
+    else
+    {
+        umaskexec_format_mask_octal(mask, mask_string);
+    }
+    printf("%s\n", mask_string);
+    return sh_chkwrite(EXECUTION_SUCCESS);
+}
+
+
+static
+int run_command(WORD_LIST * list, mode_t mask)
+{
+    char * * argv;
+    char * command;
+    pid_t pid;
+
+    maybe_make_export_env();
+    argv = strvec_from_word_list(list, 0, 0, (int *)NULL);
+
+    pid = make_child((char *)NULL, FORK_SYNC);
+    if(pid == -1)
+    {
+        strvec_dispose(argv);
+        return EXECUTION_FAILURE;
+    }
+    if(pid)
+    {
+        strvec_dispose(argv);
+        return wait_for(pid, 0);
+    }
+
+    /* In the child, which is still a copy of the shell: */
+    restore_original_signals();
+    umask(mask);
+
+    /* Uses the shell's command hash table, so repeated commands */
+    /* skip the PATH search entirely:                            */
+    command = search_for_command(*argv, 0);
+    if(!command)
+    {
+        builtin_error("error executing command: %s: not found", *argv);
+        fflush(stderr);
+        _exit(EX_NOTFOUND);
+    }
+    _exit(shell_execve(command, argv, export_env));
+}
+
+
+int umaskexec_builtin(WORD_LIST * list)
+{
+    int symbolic = 0;
+    char * mask_string;
+    mode_t mask;
+
+    /* Not internal_getopt, which rejects symbolic masks like "-w": */
+    /* as in umaskexec itself, no option is also a mask, so one    */
+    /* which is not an option is the mask.                          */
+    while(list && *list->word->word == '-')
+    {
+        char * option = list->word->word;
+        mode_t ignored_mask = 0;
+
+        if(!strcmp(option, "--"))
+        {
+            list = list->next;
+            break;
+        }
+        if(!strcmp(option, "--help"))
+        {
+            builtin_help();
+            return EX_USAGE;
+        }
+        if(!strcmp(option, "-S"))
+        {
+            symbolic = 1;
+        }
+        else
+        if(!umaskexec_parse_mask(option, &ignored_mask))
+        {
+            break;
+        }
+        else
+        {
+            sh_invalidopt(option);
+            builtin_usage();
+            return EX_USAGE;
+        }
+        list = list->next;
+    }
+
+    /* Read the shell's mask without changing it: */
+    mask = umask(0);
+    umask(mask);
+
+    if(!list)
+    {
+        return print_mask(mask, symbolic);
+    }
+
+    mask_string = list->word->word;
+    if(umaskexec_parse_mask(mask_string, &mask))
+    {
+        builtin_error("bad mask: %s", mask_string);
+        return EXECUTION_FAILURE;
+    }
+
+    list = list->next;
+    if(!list)
+    {
+        return print_mask(mask, symbolic);
+    }
+    return run_command(list, mask);
+}
+
+
+char * umaskexec_doc[] = {
+    "Execute a command with the given file mode creation mask.",
+    "",
+    "If no mask is given, show the current mask.",
+    "If no command is given, show what mask would be used.",
+    "The mask of the shell itself is never changed.",
+    "",
+    "Options:",
+    "  -S  show the mask symbolically instead of in octal",
+    (char *)NULL
+};
+
+
+struct builtin umaskexec_struct = {
+    "umaskexec",
+    umaskexec_builtin,
+    BUILTIN_ENABLED,
+    umaskexec_doc,
+    "umaskexec [-S] [mask [command [argument ...]]]",
+    0
+};
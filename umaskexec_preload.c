@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: 0BSD */
+/* Copyright 2019 Alexander Kozhevnikov <mentalisttraceur@gmail.com> */
+
+/* Loaded with LD_PRELOAD, this sets the umask from UMASKEXEC_MASK */
+/* before the program's own code runs, which saves the exec of the */
+/* umaskexec binary. The variable is then removed from the         */
+/* environment, so it is applied once rather than by descendants.  */
+
+#define _POSIX_C_SOURCE 200112L
+
+/* Standard C library headers */
+#include <stdlib.h> /* EXIT_FAILURE, getenv, unsetenv */
+#include <string.h> /* strlen */
+
+/* Standard UNIX/Linux (POSIX/SUS base) headers */
+#include <sys/stat.h> /* umask */
+#include <sys/types.h> /* mode_t */
+#include <unistd.h> /* STDERR_FILENO, _exit, write */
+
+#include "libumaskexec.h"
+
+
+static char const variable[] = "UMASKEXEC_MASK";
+
+
+static
+void error_bad_mask(char const * mask_string)
+{
+    /* Best effort: the process is about to exit anyway. */
+    if(write(STDERR_FILENO, "umaskexec: bad mask: ", 21) != -1
+    && write(STDERR_FILENO, mask_string, strlen(mask_string)) != -1)
+    {
+        write(STDERR_FILENO, "\n", 1);
+    }
+}
+
+
+__attribute__((constructor))
+static
+void umaskexec_preload(void)
+{
+    char const * mask_string = getenv(variable);
+    mode_t mask;
+
+    if(!mask_string)
+    {
+        return;
+    }
+
+    /* Octal masks do not depend on the old mask, so skip reading it: */
+    if(umaskexec_parse_mask_octal(mask_string, &mask))
+    {
+        mask = umask(0);
+        if(umaskexec_parse_mask_symbolic(mask_string, &mask))
+        {
+            /* Running with the wrong umask is worse than not running: */
+            error_bad_mask(mask_string);
+            _exit(EXIT_FAILURE);
+        }
+    }
+    umask(mask);
+    unsetenv(variable);
+}